@@ -0,0 +1,120 @@
+// Compares the C API against the constexpr C++ front end on the same
+// option set. Four cases:
+//   runtime: init + register + parse + delete per iteration
+//   parse:   parse only, options registered once
+//   cached:  parse with the parse cache enabled
+//   static:  cargs::parser<table>::parse
+//
+// usage: carg-bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "cargs.hpp"
+
+extern "C" {
+#define UTIL_IMPL
+#include "util.h"
+}
+
+struct cfg {
+    bool verbose;
+    bool force;
+    int jobs;
+    int level;
+    float scale;
+    const char *out;
+    const char *mode;
+};
+
+static constexpr auto options = cargs::make_table(
+    cargs::flag(&cfg::verbose, false, "-v", "verbose output"),
+    cargs::flag(&cfg::force, false, "--force", "overwrite output"),
+    cargs::integer(&cfg::jobs, 1, "-j", "number of jobs"),
+    cargs::integer(&cfg::level, 0, "--level", "optimization level"),
+    cargs::real(&cfg::scale, 1.0f, "--scale", "scale factor"),
+    cargs::str(&cfg::out, "a.out", "-o", "output file"),
+    cargs::str(&cfg::mode, "fast", "--mode", "run mode"));
+
+using parser = cargs::parser<options>;
+
+static char *args[] = {
+    (char *)"-v", (char *)"-j8", (char *)"--level", (char *)"3",
+    (char *)"--scale=0.5", (char *)"-o", (char *)"out.bin",
+    (char *)"--mode", (char *)"safe", (char *)"--force",
+};
+static const int nargs = sizeof(args) / sizeof(args[0]);
+
+static volatile int sink;
+
+static double
+seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void
+report(const char *label, double s, long n)
+{
+    std::printf("%-8s %8.1f ns/parse\n", label, s * 1e9 / n);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long n = (argc > 1) ? std::atol(argv[1]) : 200000;
+    cfg c;
+
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i++) {
+        cargs_t ctx;
+        cargs_init(&ctx);
+        if (parser::register_into(ctx) || cargs_parse_struct(ctx, &c, "bench", nargs, args)) {
+            std::fprintf(stderr, "%s", cargs_error(ctx));
+            return 1;
+        }
+        sink = c.jobs;
+        cargs_delete(&ctx);
+    }
+    report("runtime", seconds(start), n);
+
+    cargs_t ctx;
+    cargs_init(&ctx);
+    parser::register_into(ctx);
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i++) {
+        if (cargs_parse_struct(ctx, &c, "bench", nargs, args)) {
+            std::fprintf(stderr, "%s", cargs_error(ctx));
+            return 1;
+        }
+        sink = c.jobs;
+    }
+    report("parse", seconds(start), n);
+
+    cargs_cache(ctx, 16);
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i++) {
+        if (cargs_parse_struct(ctx, &c, "bench", nargs, args)) {
+            std::fprintf(stderr, "%s", cargs_error(ctx));
+            return 1;
+        }
+        sink = c.jobs;
+    }
+    report("cached", seconds(start), n);
+    cargs_delete(&ctx);
+
+    std::string err;
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i++) {
+        if (parser::parse(c, nargs, args, &err)) {
+            std::fprintf(stderr, "%s\n", err.c_str());
+            return 1;
+        }
+        sink = c.jobs;
+    }
+    report("static", seconds(start), n);
+
+    return 0;
+}
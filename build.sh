@@ -1,3 +1,8 @@
 #!/usr/bin/env sh
 
 gcc -o carg-test cargs.c main.c
+gcc -o carg-reload-test cargs.c reload_test.c
+gcc -o carg-roundtrip-test cargs.c roundtrip_test.c
+
+gcc -O2 -c -o cargs.o cargs.c
+g++ -std=c++17 -O2 -o carg-bench bench.cpp cargs.o
@@ -1,4 +1,9 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 
 #include "cargs.h"
 
@@ -15,19 +20,152 @@ typedef enum {
     CARGS_FLOAT,
     CARGS_STR,
     CARGS_LIST,
+    CARGS_LIST_CB,
 } dtype_t;
 
+// memoized value of an option in lazy mode
+typedef union {
+    bool b;
+    int i;
+    float f;
+    char *s;
+    char **l;
+} value_t;
+
+// snapshot image: header, one record per option, then the payloads
+// (strings and arrays) they refer to by offset from the image start
+#define SNAP_MAGIC "CARG"
+#define SNAP_VERSION 1
+#define SNAP_NULL UINT64_MAX
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t schema;
+    uint64_t size;
+    uint32_t count;
+    uint32_t reserved;
+} snaphdr_t;
+
+typedef struct {
+    uint8_t present;
+    uint8_t dtype;
+    uint16_t reserved;
+    uint32_t count;
+    uint64_t value;
+} snaprec_t;
+
+// bounded writer, keeps counting past the end so the full size is known
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t pos;
+} snapw_t;
+
+// presence bits, one per option in registration order
+typedef struct {
+    size_t count;
+    size_t capacity;
+    uint64_t *items;
+} bitset_t;
+
+// constraint masks are stored sparsely as the non-zero words of the mask
+typedef struct {
+    size_t word;
+    uint64_t bits;
+} maskword_t;
+
+typedef struct {
+    cargs_rule_t kind;
+    int trigger;
+    size_t first;
+    size_t count;
+} rule_t;
+
+// config file, tokenized in place. `wd` watches the parent directory so
+// files replaced by rename are picked up too. `parsebuf` is the buffer the
+// last parse read, strings of the parsed struct point into it.
+typedef struct {
+    char *path;
+    const char *basename;
+    char *buf;
+    char *parsebuf;
+    struct {
+        size_t count;
+        size_t capacity;
+        char **items;
+    } tokens;
+    int wd;
+    bool dirty;
+} source_t;
+
+// memoized parse result. `buf` holds the snapshot image, the argv presence
+// words, the violations, the operand indices, the argv bytes the entry is
+// keyed by, the error message and the string arrays of the image's lists,
+// in that order.
+typedef struct {
+    uint64_t hash;
+    int argc;
+    int next;
+    bool ref;
+    bool err;
+    char *buf;
+    size_t presoff;
+    size_t violoff;
+    size_t opsoff;
+    size_t keyoff;
+    size_t keylen;
+    size_t erroff;
+    size_t errlen;
+    size_t arroff;
+    int nviol;
+    int nops;
+} centry_t;
+
+// entries are chained from `buckets` by hash and evicted in CLOCK order
+typedef struct {
+    centry_t *entries;
+    int count;
+    int capacity;
+    int *buckets;
+    int nbuckets;
+    int hand;
+    int nstreams;
+    size_t hits;
+    size_t misses;
+} cache_t;
+
+// growable byte buffer holding the values of a repeatable option
+typedef struct {
+    size_t count;
+    size_t capacity;
+    char *items;
+} accbuf_t;
+
 typedef struct {
     const char *name;
     const char *help;
     void *ptr;
     int *ptrlen;
+    size_t offset;
+    size_t lenoffset;
     uintptr_t def;
     dtype_t dtype;
     int namelen;
     int helplen;
-    bool processed;
+    bool field;
+    bool accum;
     char delim;
+    accbuf_t acc;
+    cargs_list_cb_t cb;
+    void *user;
+
+    // lazy mode: argv span recorded at parse time, converted on first access
+    char *arg;
+    char *nextarg;
+    bool converted;
+    value_t val;
+    int vallen;
 } opt_t;
 
 typedef struct {
@@ -36,31 +174,244 @@ typedef struct {
     opt_t *items;
 } optlist_t;
 
+// list materialized by parse_opt_str_list, elements are collected in the
+// arena as offsets and moved to one block (pointers then strings) at the end
+struct strlist {
+    size_t count;
+    size_t capacity;
+    size_t *items;
+    ustr_builder_t *arena;
+};
+
+// namespace trie over the '.' separated segments of dotted flag names.
+// Children are found through one hash table keyed by (parent, segment),
+// `child`/`next` keep registration order for listing.
+typedef struct {
+    const char *path;
+    int pathlen;
+    int seglen;
+    int parent;
+    int opt;
+    int child;
+    int lastchild;
+    int next;
+} node_t;
+
+typedef struct {
+    struct {
+        size_t count;
+        size_t capacity;
+        node_t *items;
+    } nodes;
+    int *slots;
+    size_t nslots;
+} trie_t;
+
+// positional argument, `ptrlen` is only set for the variadic tail
+typedef struct {
+    const char *name;
+    const char *help;
+    void *ptr;
+    int *ptrlen;
+    int namelen;
+    int helplen;
+} pos_t;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    pos_t *items;
+} poslist_t;
+
+// indices into argv of every operand
+typedef struct {
+    size_t count;
+    size_t capacity;
+    int *items;
+} idxlist_t;
+
 typedef struct {
     ustr_builder_t arena;
     optlist_t optlist;
     ustr_builder_t errorlog;
+
+    // dotted names live in the trie, all others are matched linearly
+    trie_t trie;
+    idxlist_t flat;
     int namemaxlen;
     int helpmaxlen;
+
+    // struct binding: field options live at `base + offset`, their
+    // defaults are kept in `defimg`, a prebuilt image of the whole struct
+    char *defimg;
+    size_t structsize;
+    char *base;
+
+    // count repeatable options before parsing to size their buffers once
+    bool precount;
+
+    poslist_t poslist;
+    pos_t *postail;
+    idxlist_t operands;
+
+    // record argv spans at parse time and convert in the cargs_get_* calls
+    bool lazy;
+
+    bitset_t present;
+    bitset_t srcpresent;
+    bitset_t argvpresent;
+
+    struct {
+        size_t count;
+        size_t capacity;
+        source_t *items;
+    } sources;
+
+    // hot reload: readers load `current` without locking, superseded blocks
+    // and the buffers they point into wait in `retired` for cargs_reclaim.
+    // Source buffers replaced by a reload wait in `stale` until a block that
+    // no longer points into them is published.
+    int watchfd;
+    _Atomic(char *) current;
+    char *scratch;
+    bool reloading;
+    struct {
+        size_t count;
+        size_t capacity;
+        void **items;
+    } retired;
+    struct {
+        size_t count;
+        size_t capacity;
+        void **items;
+    } stale;
+
+    // constraints, masks of all rules are kept in one array
+    struct {
+        size_t count;
+        size_t capacity;
+        rule_t *items;
+    } rules;
+    struct {
+        size_t count;
+        size_t capacity;
+        maskword_t *items;
+    } maskwords;
+    struct {
+        size_t count;
+        size_t capacity;
+        cargs_violation_t *items;
+    } violations;
+
+    // list arrays handed out by the last parse, freed by the next one
+    struct {
+        size_t count;
+        size_t capacity;
+        void **items;
+    } lists;
+
+    // string arrays rebuilt by cargs_restore, pointing into the image
+    struct {
+        size_t count;
+        size_t capacity;
+        char **items;
+    } restorebuf;
+
+    cache_t cache;
 } ctx_t;
 
 static bool newopt(ctx_t *ctx, const char *name, const char *help, void *ptr, int *ptrlen, char delim, uintptr_t def, dtype_t dtype);
-
-static int parse_opt_flag(ctx_t *ctx, opt_t *opt, char *arg);
-static int parse_opt_int(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg);
-static int parse_opt_float(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg);
-static int parse_opt_str(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg);
-static int parse_opt_str_list(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg);
+static bool newfield(ctx_t *ctx, const char *name, const char *help, size_t offset, size_t size, size_t lenoffset, char delim, dtype_t dtype);
+
+static bool newpos(ctx_t *ctx, const char *name, const char *help, void *ptr, int *ptrlen);
+static bool newaccum(ctx_t *ctx, const char *name, const char *help, void *ptr, int *ptrlen, dtype_t dtype);
+
+static size_t dtype_size(dtype_t dtype);
+static void *opt_ptr(ctx_t *ctx, opt_t *opt);
+static bool opt_present(ctx_t *ctx, opt_t *opt);
+static void opt_set_present(ctx_t *ctx, opt_t *opt, bool present);
+static int *opt_ptrlen(ctx_t *ctx, opt_t *opt);
+static bool opt_is_lazy(ctx_t *ctx, opt_t *opt);
+static void opt_default(ctx_t *ctx, opt_t *opt, void *dst, int *dstlen);
+static opt_t *lazy_lookup(ctx_t *ctx, const char *name, dtype_t dtype);
+static bool lazy_convert(ctx_t *ctx, opt_t *opt);
+
+static bool newrule(ctx_t *ctx, cargs_rule_t kind, const char *name, va_list args);
+static void violation(ctx_t *ctx, rule_t *rule, int idx, int other);
+static bool check_rules(ctx_t *ctx);
+
+static int parse_opt_flag(ctx_t *ctx, opt_t *opt, char *arg, void *dst);
+static int parse_opt_int(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, void *dst);
+static int parse_opt_float(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, void *dst);
+static int parse_opt_str(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, void *dst);
+static int parse_opt_str_list(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, void *dst, int *dstlen);
+static int parse_opt_list_cb(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg);
+static int parse_opt_span(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg);
+static int parse_opt(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, void *dst, int *dstlen);
+static int scan_list(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, cargs_list_cb_t cb, void *user);
+static bool append_list_item(void *user, const char *s, int len, int index);
+static void precount_tokens(ctx_t *ctx, int argc, char **argv);
+static void precount(ctx_t *ctx, int argc, char **argv);
+static bool parse_operands(ctx_t *ctx, char **argv);
+static bool parse_tokens(ctx_t *ctx, int argc, char **argv, bool operands);
+static bool parse_fresh(ctx_t *ctx, int argc, char **argv);
+static bool parse(ctx_t *ctx, int argc, char **argv);
+
+static bool source_read(ctx_t *ctx, source_t *src);
+static bool apply_sources(ctx_t *ctx);
+static bool field_equal(opt_t *opt, const char *a, const char *b);
+static void retire(ctx_t *ctx, void *p);
+static char **list_dup(char **list, int n);
+
+static uint64_t schema_hash(ctx_t *ctx);
+static uint64_t snap_reserve(snapw_t *w, size_t len, size_t align);
+static void snap_set(snapw_t *w, uint64_t off, const void *p, size_t len);
+static uint64_t snap_put_str(snapw_t *w, const char *s);
+static uint64_t snap_put_str_list(snapw_t *w, char **items, int count);
+static bool snap_write_opt(ctx_t *ctx, snapw_t *w, opt_t *opt, snaprec_t *rec);
+static const char *snap_str(const char *img, uint64_t off);
+static bool snap_check(ctx_t *ctx, const char *img, size_t size);
+static size_t snap_count_strs(ctx_t *ctx, const char *img);
+static void snap_build_arrays(ctx_t *ctx, const char *img, char **strs);
+static void snap_read_opt(ctx_t *ctx, const char *img, opt_t *opt, snaprec_t *rec, char **strs);
+static void restore_image(ctx_t *ctx, const char *img, char **strs);
+static bool restore(ctx_t *ctx, const void *buf, size_t size);
+static size_t snapshot(ctx_t *ctx, void *buf, size_t size);
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input);
+static uint64_t xxh64(const char *p, size_t len, uint64_t seed);
+static uint64_t argv_hash(int argc, char **argv);
+static bool cache_usable(ctx_t *ctx);
+static void cache_clear(ctx_t *ctx);
+static centry_t *cache_find(ctx_t *ctx, uint64_t hash, int argc, char **argv);
+static bool cache_hit(ctx_t *ctx, centry_t *e, char **argv);
+static void cache_store(ctx_t *ctx, uint64_t hash, int argc, char **argv, bool err);
+
+static uint64_t trie_hash(int parent, const char *seg, int len);
+static int trie_find(trie_t *trie, int parent, const char *seg, int len);
+static int trie_add(trie_t *trie, int parent, const char *path, const char *seg, int len);
+static int trie_walk(trie_t *trie, const char *name, bool create);
+static void reset_node(ctx_t *ctx, int node);
+static void help_node(ctx_t *ctx, int node, size_t nw);
 
 static int match_ident(const char *s, char delim);
-static int optlist_best_match_name(optlist_t *list, const char *name);
+static int optlist_best_match_name(ctx_t *ctx, const char *name);
 
 int
-optlist_best_match_name(optlist_t *list, const char *name)
+optlist_best_match_name(ctx_t *ctx, const char *name)
 {
+    // dotted names resolve segment by segment, the cost depends on depth only
+    if (ctx->trie.nodes.count > 1) {
+        int node = trie_walk(&ctx->trie, name, false);
+        if ((node > 0) && (ctx->trie.nodes.items[node].opt >= 0))
+            return ctx->trie.nodes.items[node].opt;
+    }
+
+    optlist_t *list = &ctx->optlist;
     int best_match = -1;
     int len = 0;
-    for (int i = 0; i < list->count; i++) {
+    for (int j = 0; j < ctx->flat.count; j++) {
+        int i = ctx->flat.items[j];
         if (0 == strncmp(list->items[i].name, name, list->items[i].namelen)) {
             if (len < list->items[i].namelen) {
                 len = list->items[i].namelen;
@@ -71,478 +422,2711 @@ optlist_best_match_name(optlist_t *list, const char *name)
     return best_match;
 }
 
+uint64_t
+trie_hash(int parent, const char *seg, int len)
+{
+    uint64_t h = 0xcbf29ce484222325ull ^ (uint64_t)parent;
+    for (int i = 0; i < len; i++)
+        h = (h ^ (unsigned char)seg[i]) * 0x100000001b3ull;
+    return h;
+}
+
+int
+trie_find(trie_t *trie, int parent, const char *seg, int len)
+{
+    size_t mask = trie->nslots - 1;
+    for (size_t i = trie_hash(parent, seg, len) & mask; trie->slots[i] >= 0; i = (i + 1) & mask) {
+        node_t *n = &trie->nodes.items[trie->slots[i]];
+        if ((n->parent == parent) && (n->seglen == len) &&
+            (0 == memcmp(n->path + n->pathlen - len, seg, len)))
+            return trie->slots[i];
+    }
+    return -1;
+}
+
+int
+trie_add(trie_t *trie, int parent, const char *path, const char *seg, int len)
+{
+    int idx = trie_find(trie, parent, seg, len);
+    if (idx >= 0)
+        return idx;
+
+    // keep the table at most half full
+    if (2 * trie->nodes.count >= trie->nslots) {
+        free(trie->slots);
+        trie->nslots *= 2;
+        trie->slots = umalloc(trie->nslots * sizeof(int));
+        memset(trie->slots, 0xff, trie->nslots * sizeof(int));
+        for (int i = 1; i < trie->nodes.count; i++) {
+            node_t *n = &trie->nodes.items[i];
+            size_t j = trie_hash(n->parent, n->path + n->pathlen - n->seglen, n->seglen) & (trie->nslots - 1);
+            while (trie->slots[j] >= 0)
+                j = (j + 1) & (trie->nslots - 1);
+            trie->slots[j] = i;
+        }
+    }
+
+    node_t n;
+    n.path = path;
+    n.pathlen = seg + len - path;
+    n.seglen = len;
+    n.parent = parent;
+    n.opt = -1;
+    n.child = -1;
+    n.lastchild = -1;
+    n.next = -1;
+    idx = trie->nodes.count;
+    da_append(&trie->nodes, n);
+
+    node_t *p = &trie->nodes.items[parent];
+    if (p->lastchild >= 0)
+        trie->nodes.items[p->lastchild].next = idx;
+    else
+        p->child = idx;
+    p->lastchild = idx;
+
+    size_t j = trie_hash(parent, seg, len) & (trie->nslots - 1);
+    while (trie->slots[j] >= 0)
+        j = (j + 1) & (trie->nslots - 1);
+    trie->slots[j] = idx;
+
+    return idx;
+}
+
+int
+trie_walk(trie_t *trie, const char *name, bool create)
+{
+    // segments end at '.', the key ends at '=' or the end of the token
+    int node = 0;
+    const char *seg = name;
+    for (;;) {
+        int len = strcspn(seg, ".=");
+        node = create
+            ? trie_add(trie, node, name, seg, len)
+            : trie_find(trie, node, seg, len);
+        if ((node < 0) || (seg[len] != '.'))
+            return node;
+        seg += len + 1;
+    }
+}
+
+void
+reset_node(ctx_t *ctx, int node)
+{
+    for (int c = ctx->trie.nodes.items[node].child; c >= 0; c = ctx->trie.nodes.items[c].next)
+        reset_node(ctx, c);
+
+    int idx = ctx->trie.nodes.items[node].opt;
+    if (idx < 0)
+        return;
+
+    opt_t *opt = &ctx->optlist.items[idx];
+    opt_set_present(ctx, opt, false);
+    opt->converted = false;
+
+    if (opt->accum) {
+        opt->acc.count = 0;
+        *(void **)opt->ptr = NULL;
+        *opt->ptrlen = 0;
+    } else if (!opt_is_lazy(ctx, opt) && (opt->dtype != CARGS_LIST_CB)) {
+        if (opt->field)
+            UASSERT(ctx->base && "struct-bound options need a base");
+        opt_default(ctx, opt, opt_ptr(ctx, opt), opt_ptrlen(ctx, opt));
+    }
+}
+
+void
+help_node(ctx_t *ctx, int node, size_t nw)
+{
+    node_t *n = &ctx->trie.nodes.items[node];
+
+    // options directly under this namespace form one section
+    bool header = false;
+    for (int c = n->child; c >= 0; c = ctx->trie.nodes.items[c].next) {
+        opt_t *opt;
+        if (ctx->trie.nodes.items[c].opt < 0)
+            continue;
+        if (!header) {
+            ustr_builder_printf(&ctx->arena, "\n%.*s:\n", n->pathlen, n->path);
+            header = true;
+        }
+        opt = &ctx->optlist.items[ctx->trie.nodes.items[c].opt];
+        ustr_builder_printf(&ctx->arena, "   %-*s   %s\n", nw, opt->name, opt->help);
+    }
+
+    for (int c = n->child; c >= 0; c = ctx->trie.nodes.items[c].next)
+        help_node(ctx, c, nw);
+}
+
 bool
 newopt(ctx_t *ctx, const char *name, const char *help, void *ptr, int *ptrlen, char delim, uintptr_t def, dtype_t dtype)
 {
     UASSERT(ctx);
     UASSERT(name);
     UASSERT(help);
-    UASSERT(ptr);
 
-    int idx = optlist_best_match_name(&ctx->optlist, name);
+    int idx = optlist_best_match_name(ctx, name);
     if ((idx >= 0) && (0 == strcmp(name, ctx->optlist.items[idx].name))) {
         ustr_builder_printf(&ctx->errorlog, "Flag '%s' already exists\n", name);
         return true;
     }
 
+    if (strchr(name, '=')) {
+        ustr_builder_printf(&ctx->errorlog, "Invalid flag name '%s'\n", name);
+        return true;
+    }
+
     opt_t opt;
     char *s;
 
-    // copy name to arena
-    s = da_endptr(&ctx->arena);
+    // name and help share one allocation so they never move
     opt.namelen = strlen(name);
-    da_append_many(&ctx->arena, name, opt.namelen + 1);
-    s[opt.namelen] = '\0';
+    opt.helplen = strlen(help);
+    s = umalloc(opt.namelen + opt.helplen + 2);
+    memcpy(s, name, opt.namelen + 1);
+    memcpy(s + opt.namelen + 1, help, opt.helplen + 1);
     opt.name = s;
+    opt.help = s + opt.namelen + 1;
 
     if (ctx->namemaxlen < opt.namelen)
         ctx->namemaxlen = opt.namelen;
 
-    // copy help to &ctx->arena
-    s = da_endptr(&ctx->arena);
-    opt.helplen = strlen(help);
-    da_append_many(&ctx->arena, help, opt.helplen + 1);
-    s[opt.helplen] = '\0';
-    opt.help = s;
-
     if (ctx->helpmaxlen < opt.helplen)
         ctx->helpmaxlen = opt.helplen;
 
     opt.ptr = ptr;
     opt.ptrlen = ptrlen;
+    opt.offset = 0;
+    opt.lenoffset = 0;
     opt.dtype = dtype;
-    opt.processed = false;
+    opt.field = false;
+    opt.accum = false;
+    memset(&opt.acc, 0, sizeof(opt.acc));
+    opt.cb = NULL;
+    opt.user = NULL;
+    opt.arg = NULL;
+    opt.nextarg = NULL;
+    opt.converted = false;
+    opt.vallen = 0;
     opt.def = def;
     opt.delim = delim;
 
     da_append(&ctx->optlist, opt);
 
-    return false;
-}
+    // cached results no longer match the option set
+    cache_clear(ctx);
+    if (dtype == CARGS_LIST_CB)
+        ctx->cache.nstreams++;
 
-int
-match_ident(const char *s, char delim)
-{
-    size_t n = 0;
-    for (;;) {
-        // reached end of current identifier
-        if ((s[n] == delim) || (s[n] == '\0')) {
-            return n;
-        }
-        // invalid identifier char
-        if (!(isletter(s[n]) || (s[n] == '_') || isnumber(s[n])))
-            return -(n + 1);
-        n++;
+    if (strchr(opt.name, '.')) {
+        int node = trie_walk(&ctx->trie, opt.name, true);
+        ctx->trie.nodes.items[node].opt = ctx->optlist.count - 1;
+    } else {
+        da_append(&ctx->flat, ctx->optlist.count - 1);
     }
+
+    if (ctx->optlist.count > ctx->present.count * 64) {
+        da_append(&ctx->present, 0);
+        da_append(&ctx->srcpresent, 0);
+        da_append(&ctx->argvpresent, 0);
+    }
+
+    return false;
 }
 
-int
-parse_opt_str_list(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg)
+bool
+newpos(ctx_t *ctx, const char *name, const char *help, void *ptr, int *ptrlen)
 {
-    struct strlist {
-        int count;
-        int capacity;
-        char **items;
-    } slist;
-    da_init(&slist, 1);
-
-    // original count to reset arena to original state upon error
-    size_t orig_count = ctx->arena.count;
+    UASSERT(ctx);
+    UASSERT(name);
+    UASSERT(help);
+    UASSERT(ptr);
 
-    int rc;
-    char *chain;
-    size_t len = strlen(arg);
-    if (len == opt->namelen) {
-        rc = 2;
-        chain = nextarg;
-    } else {
-        rc = 1;
-        chain = &arg[len];
+    if (ptrlen && ctx->postail) {
+        ustr_builder_printf(&ctx->errorlog, "Positional tail '%s' already exists\n", ctx->postail->name);
+        return true;
     }
 
-    size_t i = 0;
-    size_t n = 0;
-    for (;;) {
-        int l = match_ident(chain + i, opt->delim);
+    pos_t pos;
+    char *s;
 
-        // match error
-        if (l < 0) {
-            ustr_builder_printf(&ctx->errorlog, "Invalid char in chain\n");
-            ustr_builder_printf(&ctx->errorlog, "%s\n", chain);
-            ustr_builder_printf(&ctx->errorlog, "%*s\n", i - l, "^");
-            ctx->arena.count = orig_count;
-            rc = -1;
-            break;
-        }
+    // name and help share one allocation so they never move
+    pos.namelen = strlen(name);
+    pos.helplen = strlen(help);
+    s = umalloc(pos.namelen + pos.helplen + 2);
+    memcpy(s, name, pos.namelen + 1);
+    memcpy(s + pos.namelen + 1, help, pos.helplen + 1);
+    pos.name = s;
+    pos.help = s + pos.namelen + 1;
 
-        char *str = ustr_builder_printf(&ctx->arena, "%.*s", l, chain + i);
-        ustr_builder_terminate(&ctx->arena);
+    if (ctx->namemaxlen < pos.namelen)
+        ctx->namemaxlen = pos.namelen;
 
-        da_append(&slist, str);
+    if (ctx->helpmaxlen < pos.helplen)
+        ctx->helpmaxlen = pos.helplen;
 
-        i += l;
+    pos.ptr = ptr;
+    pos.ptrlen = ptrlen;
 
-        // reached end of chain string
-        if (chain[i] == '\0')
-            break;
+    // the tail is kept apart from the named slots
+    if (ptrlen) {
+        ctx->postail = umalloc(sizeof(pos_t));
+        *ctx->postail = pos;
+    } else {
+        da_append(&ctx->poslist, pos);
+    }
 
-        // jump over divider
-        else if ((chain[i] == opt->delim) && !(chain[i+1] == '\0'))
-            i++;
+    cache_clear(ctx);
+    return false;
+}
 
-        // trailing delimiter
-        else {
-            // ignore
-            break;
-        }
-    }
+bool
+newfield(ctx_t *ctx, const char *name, const char *help, size_t offset, size_t size, size_t lenoffset, char delim, dtype_t dtype)
+{
+    UASSERT(ctx);
+    UASSERT(ctx->defimg && "cargs_bind_struct not called");
 
-    if (rc > 0) {
-        *(char ***)opt->ptr = slist.items;
-        *opt->ptrlen = slist.count;
+    if ((offset + size > ctx->structsize) ||
+        ((dtype == CARGS_LIST) && (lenoffset + sizeof(int) > ctx->structsize))) {
+        ustr_builder_printf(&ctx->errorlog, "Field for flag '%s' is out of struct bounds\n", name);
+        return true;
     }
 
-    return rc;
-}
+    if (newopt(ctx, name, help, NULL, NULL, delim, 0, dtype))
+        return true;
 
-void
-cargs_init(cargs_t *context)
-{
-    UASSERT(context);
-    ctx_t *ctx = umalloc(sizeof(ctx_t));
-    ustr_builder_alloc(&ctx->arena);
-    da_init(&ctx->optlist, 1);
-    ustr_builder_alloc(&ctx->errorlog);
-    ctx->namemaxlen = 0;
-    ctx->helpmaxlen = 0;
-    *context = (cargs_t)ctx;
-}
+    opt_t *opt = da_last_item(&ctx->optlist);
+    opt->field = true;
+    opt->offset = offset;
+    opt->lenoffset = lenoffset;
 
-void
-cargs_delete(cargs_t *context)
-{
-    UASSERT(context);
-    UASSERT(*context);
-    ctx_t *ctx = (ctx_t *)*context;
-    ustr_builder_free(&ctx->arena);
-    da_delete(&ctx->optlist);
-    if (ctx->errorlog.items)
-        ustr_builder_free(&ctx->errorlog);
-    free(ctx);
-    *context = (cargs_t)NULL;
+    return false;
 }
 
-const char *
-cargs_error(cargs_t context)
+bool
+newaccum(ctx_t *ctx, const char *name, const char *help, void *ptr, int *ptrlen, dtype_t dtype)
 {
-    UASSERT(context);
-    ctx_t *ctx = (ctx_t *)context;
-    if (*da_last_item(&ctx->errorlog) == '\n')
-        da_pop(&ctx->errorlog);
-    ustr_builder_terminate(&ctx->errorlog);
-    return ctx->errorlog.items;
+    UASSERT(ctx);
+    UASSERT(ptr);
+    UASSERT(ptrlen);
+
+    if (newopt(ctx, name, help, ptr, ptrlen, '\0', 0, dtype))
+        return true;
+
+    opt_t *opt = da_last_item(&ctx->optlist);
+    opt->accum = true;
+    da_init(&opt->acc, 16 * dtype_size(dtype));
+
+    return false;
 }
 
-bool
-cargs_add_opt_flag(cargs_t context, bool *v, bool def, const char *name, const char *help)
+size_t
+dtype_size(dtype_t dtype)
 {
-    UASSERT(context);
-    return newopt((ctx_t *)context, name, help, (void *)v, NULL, '\0', (uintptr_t)def, CARGS_BOOL);
+    switch (dtype) {
+    case CARGS_BOOL: return sizeof(bool);
+    case CARGS_INT: return sizeof(int);
+    case CARGS_FLOAT: return sizeof(float);
+    case CARGS_STR: return sizeof(char *);
+    case CARGS_LIST: return sizeof(char **);
+    case CARGS_LIST_CB: return 0;
+    default:
+        UASSERT(0 && "unreachable");
+        return 0;
+    }
 }
 
-bool
-cargs_add_opt_int(cargs_t context, int *v, int def, const char *name, const char *help)
+void *
+opt_ptr(ctx_t *ctx, opt_t *opt)
 {
-    UASSERT(context);
-    return newopt((ctx_t *)context, name, help, (void *)v, NULL, '\0', (uintptr_t)def, CARGS_INT);
+    return opt->field ? ctx->base + opt->offset : opt->ptr;
 }
 
-bool
-cargs_add_opt_float(cargs_t context, float *v, float def, const char *name, const char *help)
+int *
+opt_ptrlen(ctx_t *ctx, opt_t *opt)
 {
-    UASSERT(context);
-    return newopt((ctx_t *)context, name, help, (void *)v, NULL, '\0', (uintptr_t)def, CARGS_FLOAT);
+    return opt->field ? (int *)(ctx->base + opt->lenoffset) : opt->ptrlen;
 }
 
 bool
-cargs_add_opt_str(cargs_t context, char **v, const char *def, const char *name, const char *help)
+opt_present(ctx_t *ctx, opt_t *opt)
 {
-    UASSERT(context);
-    return newopt((ctx_t *)context, name, help, (void *)v, NULL, '\0', (uintptr_t)def, CARGS_STR);
+    size_t idx = opt - ctx->optlist.items;
+    return (ctx->present.items[idx / 64] >> (idx % 64)) & 1;
 }
 
-bool
-cargs_add_opt_str_list(cargs_t context, char ***v, int *vlen, char delim, const char *name, const char *help)
+void
+opt_set_present(ctx_t *ctx, opt_t *opt, bool present)
 {
-    UASSERT(context);
-    return newopt((ctx_t *)context, name, help, (void *)v, vlen, delim, 0, CARGS_LIST);
+    size_t idx = opt - ctx->optlist.items;
+    uint64_t bit = (uint64_t)1 << (idx % 64);
+    if (present)
+        ctx->present.items[idx / 64] |= bit;
+    else
+        ctx->present.items[idx / 64] &= ~bit;
 }
 
-const char *
-cargs_help(cargs_t context, const char *name)
+bool
+newrule(ctx_t *ctx, cargs_rule_t kind, const char *name, va_list args)
 {
-    UASSERT(context);
+    UASSERT(ctx);
     UASSERT(name);
-    ctx_t *ctx = (ctx_t *)context;
 
-    char *helpmsg = da_endptr(&ctx->arena);
-
-    size_t nw = ctx->namemaxlen;
-    size_t hw = ctx->helpmaxlen;
+    rule_t rule;
+    rule.kind = kind;
+    rule.trigger = -1;
+    rule.first = ctx->maskwords.count;
+    rule.count = 0;
+
+    for (const char *n = name; n; n = va_arg(args, const char *)) {
+        int idx = optlist_best_match_name(ctx, n);
+        if ((idx < 0) || (0 != strcmp(n, ctx->optlist.items[idx].name))) {
+            ustr_builder_printf(&ctx->errorlog, "Unknown flag '%s' in constraint\n", n);
+            ctx->maskwords.count = rule.first;
+            return true;
+        }
 
-    ustr_builder_printf(&ctx->arena, "Usage: %s [OPTIONS] command\n\nOptions:\n", name);
+        // the first flag of a requires rule is the trigger, not in the mask
+        if ((kind == CARGS_RULE_REQUIRES) && (rule.trigger < 0)) {
+            rule.trigger = idx;
+            continue;
+        }
 
-    size_t len = 0;
-    for (int i = 0; i < ctx->optlist.count; i++) {
-        ustr_builder_printf(&ctx->arena, "   %-*s   %s", nw, ctx->optlist.items[i].name, ctx->optlist.items[i].help);
-        if (i < ctx->optlist.count - 1)
-            ustr_builder_putc(&ctx->arena, '\n');
+        size_t w = idx / 64;
+        uint64_t bit = (uint64_t)1 << (idx % 64);
+        size_t j;
+        for (j = rule.first; j < ctx->maskwords.count; j++) {
+            if (ctx->maskwords.items[j].word == w)
+                break;
+        }
+        if (j == ctx->maskwords.count) {
+            maskword_t mw = { w, 0 };
+            da_append(&ctx->maskwords, mw);
+        }
+        ctx->maskwords.items[j].bits |= bit;
     }
 
-    ustr_builder_terminate(&ctx->arena);
+    rule.count = ctx->maskwords.count - rule.first;
+    da_append(&ctx->rules, rule);
 
-    return helpmsg;
+    cache_clear(ctx);
+    return false;
 }
 
-int
-parse_opt_flag(ctx_t *ctx, opt_t *opt, char *arg)
+void
+violation(ctx_t *ctx, rule_t *rule, int idx, int other)
 {
-    UASSERT(opt);
-    UASSERT(arg);
+    cargs_violation_t v;
+    v.rule = rule->kind;
+    v.name = ctx->optlist.items[idx].name;
+    v.other = (other >= 0) ? ctx->optlist.items[other].name : NULL;
+    da_append(&ctx->violations, v);
+
+    switch (rule->kind) {
+    case CARGS_RULE_REQUIRED:
+        ustr_builder_printf(&ctx->errorlog, "Missing required flag '%s'\n", v.name);
+        break;
+    case CARGS_RULE_REQUIRES:
+        ustr_builder_printf(&ctx->errorlog, "Flag '%s' requires '%s'\n", v.name, v.other);
+        break;
+    case CARGS_RULE_CONFLICTS:
+        ustr_builder_printf(&ctx->errorlog, "Flags '%s' and '%s' are mutually exclusive\n", v.name, v.other);
+        break;
+    case CARGS_RULE_ONE_OF:
+        ustr_builder_printf(&ctx->errorlog, "One of the flags");
+        for (size_t i = rule->first; i < rule->first + rule->count; i++) {
+            maskword_t *mw = &ctx->maskwords.items[i];
+            for (uint64_t b = mw->bits; b; b &= b - 1)
+                ustr_builder_printf(&ctx->errorlog, " '%s'", ctx->optlist.items[mw->word * 64 + __builtin_ctzll(b)].name);
+        }
+        ustr_builder_printf(&ctx->errorlog, " is required\n");
+        break;
+    default:
+        break;
+    }
+}
+
+bool
+check_rules(ctx_t *ctx)
+{
+    uint64_t *present = ctx->present.items;
+    ctx->violations.count = 0;
+
+    for (int r = 0; r < ctx->rules.count; r++) {
+        rule_t *rule = &ctx->rules.items[r];
+        maskword_t *mw = &ctx->maskwords.items[rule->first];
+
+        if ((rule->kind == CARGS_RULE_REQUIRES) &&
+            !((present[rule->trigger / 64] >> (rule->trigger % 64)) & 1))
+            continue;
+
+        switch (rule->kind) {
+        case CARGS_RULE_REQUIRED:
+        case CARGS_RULE_REQUIRES:
+            for (size_t i = 0; i < rule->count; i++) {
+                uint64_t missing = mw[i].bits & ~present[mw[i].word];
+                if (missing) {
+                    int idx = mw[i].word * 64 + __builtin_ctzll(missing);
+                    if (rule->kind == CARGS_RULE_REQUIRED)
+                        violation(ctx, rule, idx, -1);
+                    else
+                        violation(ctx, rule, rule->trigger, idx);
+                    break;
+                }
+            }
+            break;
+
+        case CARGS_RULE_CONFLICTS: {
+            int seen = -1;
+            for (size_t i = 0; i < rule->count; i++) {
+                uint64_t set = mw[i].bits & present[mw[i].word];
+                if (!set)
+                    continue;
+                // only look for the offending pair when there is one
+                if ((seen < 0) && !(set & (set - 1))) {
+                    seen = mw[i].word * 64 + __builtin_ctzll(set);
+                    continue;
+                }
+                if (seen < 0) {
+                    seen = mw[i].word * 64 + __builtin_ctzll(set);
+                    set &= set - 1;
+                }
+                violation(ctx, rule, seen, mw[i].word * 64 + __builtin_ctzll(set));
+                break;
+            }
+            break;
+        }
+
+        case CARGS_RULE_ONE_OF: {
+            uint64_t any = 0;
+            for (size_t i = 0; i < rule->count; i++)
+                any |= mw[i].bits & present[mw[i].word];
+            if (!any)
+                violation(ctx, rule, mw[0].word * 64 + __builtin_ctzll(mw[0].bits), -1);
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+
+    return ctx->violations.count > 0;
+}
+
+bool
+opt_is_lazy(ctx_t *ctx, opt_t *opt)
+{
+    // repeatable and streaming options are always handled eagerly
+    return ctx->lazy && !opt->accum && (opt->dtype != CARGS_LIST_CB);
+}
+
+void
+opt_default(ctx_t *ctx, opt_t *opt, void *dst, int *dstlen)
+{
+    if (opt->field) {
+        memcpy(dst, ctx->defimg + opt->offset, dtype_size(opt->dtype));
+        if (opt->dtype == CARGS_LIST)
+            *dstlen = 0;
+        return;
+    }
+
+    switch (opt->dtype) {
+    case CARGS_BOOL:
+        *(bool *)dst = (bool)opt->def;
+        break;
+    case CARGS_INT:
+        *(int *)dst = (int)opt->def;
+        break;
+    case CARGS_FLOAT:
+        *(float *)dst = (float)opt->def;
+        break;
+    case CARGS_STR:
+        *(char **)dst = (char *)opt->def;
+        break;
+    case CARGS_LIST:
+        *(char ***)dst = (char **)opt->def;
+        *dstlen = 0;
+    default:
+        break;
+    }
+}
+
+opt_t *
+lazy_lookup(ctx_t *ctx, const char *name, dtype_t dtype)
+{
+    UASSERT(name);
+
+    // report only the errors of this access
+    ctx->errorlog.count = 0;
+
+    int idx = optlist_best_match_name(ctx, name);
+    if ((idx < 0) || (0 != strcmp(name, ctx->optlist.items[idx].name))) {
+        ustr_builder_printf(&ctx->errorlog, "Unknown flag '%s'\n", name);
+        return NULL;
+    }
+
+    opt_t *opt = &ctx->optlist.items[idx];
+    if ((opt->dtype != dtype) || !opt_is_lazy(ctx, opt)) {
+        ustr_builder_printf(&ctx->errorlog, "Flag '%s' has no accessor of this type\n", name);
+        return NULL;
+    }
+
+    return opt;
+}
+
+bool
+lazy_convert(ctx_t *ctx, opt_t *opt)
+{
+    if (opt->converted)
+        return false;
+
+    if (!opt_present(ctx, opt))
+        opt_default(ctx, opt, &opt->val, &opt->vallen);
+    else if (parse_opt(ctx, opt, opt->arg, opt->nextarg, &opt->val, &opt->vallen) < 0)
+        return true;
+
+    opt->converted = true;
+    return false;
+}
+
+int
+match_ident(const char *s, char delim)
+{
+    size_t n = 0;
+    for (;;) {
+        // reached end of current identifier
+        if ((s[n] == delim) || (s[n] == '\0')) {
+            return n;
+        }
+        // invalid identifier char
+        if (!(isletter(s[n]) || (s[n] == '_') || isnumber(s[n])))
+            return -(n + 1);
+        n++;
+    }
+}
+
+int
+scan_list(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, cargs_list_cb_t cb, void *user)
+{
+    int rc;
+    char *chain;
+    size_t len = strlen(arg);
+    if (len > opt->namelen) {
+        rc = 1;
+        chain = (arg[opt->namelen] == '=')
+            ? arg + opt->namelen + 1
+            : arg + opt->namelen;
+    } else if (nextarg == NULL) {
+        ustr_builder_printf(&ctx->errorlog, "Missing operand for flag '%s'\n", opt->name);
+        return -1;
+    } else {
+        rc = 2;
+        chain = nextarg;
+    }
+
+    size_t i = 0;
+    int idx = 0;
+    for (;;) {
+        int l = match_ident(chain + i, opt->delim);
+
+        // match error
+        if (l < 0) {
+            ustr_builder_printf(&ctx->errorlog, "Invalid char in chain\n");
+            ustr_builder_printf(&ctx->errorlog, "%s\n", chain);
+            ustr_builder_printf(&ctx->errorlog, "%*s\n", i - l, "^");
+            return -1;
+        }
+
+        if (cb(user, chain + i, l, idx)) {
+            ustr_builder_printf(&ctx->errorlog, "List callback aborted at element %d of flag '%s'\n", idx, opt->name);
+            return -1;
+        }
+
+        idx++;
+        i += l;
+
+        // reached end of chain string
+        if (chain[i] == '\0')
+            break;
+
+        // jump over divider
+        else if ((chain[i] == opt->delim) && !(chain[i+1] == '\0'))
+            i++;
+
+        // trailing delimiter
+        else {
+            // ignore
+            break;
+        }
+    }
+
+    return rc;
+}
+
+bool
+append_list_item(void *user, const char *s, int len, int index)
+{
+    struct strlist *slist = user;
+    da_append(slist, slist->arena->count);
+    da_append_many(slist->arena, s, len);
+    ustr_builder_terminate(slist->arena);
+    return false;
+}
+
+int
+parse_opt_str_list(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, void *dst, int *dstlen)
+{
+    struct strlist slist;
+    slist.arena = &ctx->arena;
+    da_init(&slist, 1);
+
+    // original count to reset arena to original state upon error
+    size_t orig_count = ctx->arena.count;
+
+    int rc = scan_list(ctx, opt, arg, nextarg, append_list_item, &slist);
+
+    if (rc > 0) {
+        size_t size = ctx->arena.count - orig_count;
+        char **list = umalloc(slist.count * sizeof(char *) + size);
+        char *strs = (char *)(list + slist.count);
+        memcpy(strs, ctx->arena.items + orig_count, size);
+        for (int i = 0; i < slist.count; i++)
+            list[i] = strs + (slist.items[i] - orig_count);
+        *(char ***)dst = list;
+        *dstlen = slist.count;
+
+        // lists parsed by a reload belong to the published blocks
+        if (!ctx->reloading)
+            da_append(&ctx->lists, list);
+    }
+
+    ctx->arena.count = orig_count;
+    da_delete(&slist);
+
+    return rc;
+}
+
+int
+parse_opt_list_cb(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg)
+{
+    return scan_list(ctx, opt, arg, nextarg, opt->cb, opt->user);
+}
+
+void
+cargs_init(cargs_t *context)
+{
+    UASSERT(context);
+    ctx_t *ctx = umalloc(sizeof(ctx_t));
+    ustr_builder_alloc(&ctx->arena);
+    da_init(&ctx->optlist, 1);
+    ustr_builder_alloc(&ctx->errorlog);
+    da_init(&ctx->flat, 1);
+    da_init(&ctx->trie.nodes, 16);
+    ctx->trie.nslots = 32;
+    ctx->trie.slots = umalloc(ctx->trie.nslots * sizeof(int));
+    memset(ctx->trie.slots, 0xff, ctx->trie.nslots * sizeof(int));
+    {
+        // root, the empty namespace
+        node_t root = { "", 0, 0, -1, -1, -1, -1, -1 };
+        da_append(&ctx->trie.nodes, root);
+    }
+    ctx->namemaxlen = 0;
+    ctx->helpmaxlen = 0;
+    ctx->defimg = NULL;
+    ctx->structsize = 0;
+    ctx->base = NULL;
+    ctx->precount = false;
+    da_init(&ctx->poslist, 1);
+    ctx->postail = NULL;
+    da_init(&ctx->operands, 1);
+    ctx->lazy = false;
+    da_init(&ctx->lists, 1);
+    da_init(&ctx->restorebuf, 1);
+    da_init(&ctx->present, 1);
+    da_init(&ctx->srcpresent, 1);
+    da_init(&ctx->argvpresent, 1);
+    da_init(&ctx->sources, 1);
+    ctx->watchfd = -1;
+    atomic_init(&ctx->current, NULL);
+    ctx->scratch = NULL;
+    ctx->reloading = false;
+    da_init(&ctx->retired, 1);
+    da_init(&ctx->stale, 1);
+    da_init(&ctx->rules, 1);
+    da_init(&ctx->maskwords, 1);
+    da_init(&ctx->violations, 1);
+    memset(&ctx->cache, 0, sizeof(ctx->cache));
+    *context = (cargs_t)ctx;
+}
+
+void
+cargs_delete(cargs_t *context)
+{
+    UASSERT(context);
+    UASSERT(*context);
+    ctx_t *ctx = (ctx_t *)*context;
+
+    // lists of the published block are its own
+    char *cur = atomic_load(&ctx->current);
+    for (int i = 0; cur && (i < ctx->optlist.count); i++) {
+        opt_t *opt = &ctx->optlist.items[i];
+        if (opt->field && (opt->dtype == CARGS_LIST))
+            free(*(char ***)(cur + opt->offset));
+    }
+
+    ustr_builder_free(&ctx->arena);
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        free((char *)ctx->optlist.items[i].name);
+        if (ctx->optlist.items[i].accum)
+            da_delete(&ctx->optlist.items[i].acc);
+    }
+    da_delete(&ctx->optlist);
+    da_delete(&ctx->flat);
+    da_delete(&ctx->trie.nodes);
+    free(ctx->trie.slots);
+    for (int i = 0; i < ctx->poslist.count; i++)
+        free((char *)ctx->poslist.items[i].name);
+    da_delete(&ctx->poslist);
+    if (ctx->postail)
+        free((char *)ctx->postail->name);
+    free(ctx->postail);
+    da_delete(&ctx->operands);
+    for (int i = 0; i < ctx->lists.count; i++)
+        free(ctx->lists.items[i]);
+    da_delete(&ctx->lists);
+    da_delete(&ctx->restorebuf);
+    da_delete(&ctx->present);
+    da_delete(&ctx->srcpresent);
+    da_delete(&ctx->argvpresent);
+    for (int i = 0; i < ctx->sources.count; i++) {
+        free(ctx->sources.items[i].path);
+        if (ctx->sources.items[i].parsebuf != ctx->sources.items[i].buf)
+            free(ctx->sources.items[i].parsebuf);
+        free(ctx->sources.items[i].buf);
+        da_delete(&ctx->sources.items[i].tokens);
+    }
+    da_delete(&ctx->sources);
+    if (ctx->watchfd >= 0)
+        close(ctx->watchfd);
+    free(cur);
+    free(ctx->scratch);
+    cargs_reclaim(*context);
+    da_delete(&ctx->retired);
+    for (int i = 0; i < ctx->stale.count; i++)
+        free(ctx->stale.items[i]);
+    da_delete(&ctx->stale);
+    da_delete(&ctx->rules);
+    da_delete(&ctx->maskwords);
+    da_delete(&ctx->violations);
+    cache_clear(ctx);
+    free(ctx->cache.entries);
+    free(ctx->cache.buckets);
+    if (ctx->errorlog.items)
+        ustr_builder_free(&ctx->errorlog);
+    free(ctx->defimg);
+    free(ctx);
+    *context = (cargs_t)NULL;
+}
+
+const char *
+cargs_error(cargs_t context)
+{
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    if (ctx->errorlog.count && (*da_last_item(&ctx->errorlog) == '\n'))
+        da_pop(&ctx->errorlog);
+    ustr_builder_terminate(&ctx->errorlog);
+    return ctx->errorlog.items;
+}
+
+bool
+cargs_add_opt_flag(cargs_t context, bool *v, bool def, const char *name, const char *help)
+{
+    UASSERT(context);
+    UASSERT(v || ((ctx_t *)context)->lazy);
+    return newopt((ctx_t *)context, name, help, (void *)v, NULL, '\0', (uintptr_t)def, CARGS_BOOL);
+}
+
+bool
+cargs_add_opt_int(cargs_t context, int *v, int def, const char *name, const char *help)
+{
+    UASSERT(context);
+    UASSERT(v || ((ctx_t *)context)->lazy);
+    return newopt((ctx_t *)context, name, help, (void *)v, NULL, '\0', (uintptr_t)def, CARGS_INT);
+}
+
+bool
+cargs_add_opt_float(cargs_t context, float *v, float def, const char *name, const char *help)
+{
+    UASSERT(context);
+    UASSERT(v || ((ctx_t *)context)->lazy);
+    return newopt((ctx_t *)context, name, help, (void *)v, NULL, '\0', (uintptr_t)def, CARGS_FLOAT);
+}
+
+bool
+cargs_add_opt_str(cargs_t context, char **v, const char *def, const char *name, const char *help)
+{
+    UASSERT(context);
+    UASSERT(v || ((ctx_t *)context)->lazy);
+    return newopt((ctx_t *)context, name, help, (void *)v, NULL, '\0', (uintptr_t)def, CARGS_STR);
+}
+
+bool
+cargs_add_opt_str_list(cargs_t context, char ***v, int *vlen, char delim, const char *name, const char *help)
+{
+    UASSERT(context);
+    UASSERT(v || ((ctx_t *)context)->lazy);
+    return newopt((ctx_t *)context, name, help, (void *)v, vlen, delim, 0, CARGS_LIST);
+}
+
+bool
+cargs_add_opt_int_accum(cargs_t context, int **v, int *vlen, const char *name, const char *help)
+{
+    UASSERT(context);
+    return newaccum((ctx_t *)context, name, help, (void *)v, vlen, CARGS_INT);
+}
+
+bool
+cargs_add_opt_float_accum(cargs_t context, float **v, int *vlen, const char *name, const char *help)
+{
+    UASSERT(context);
+    return newaccum((ctx_t *)context, name, help, (void *)v, vlen, CARGS_FLOAT);
+}
+
+bool
+cargs_add_opt_str_accum(cargs_t context, char ***v, int *vlen, const char *name, const char *help)
+{
+    UASSERT(context);
+    return newaccum((ctx_t *)context, name, help, (void *)v, vlen, CARGS_STR);
+}
+
+bool
+cargs_add_opt_list_cb(cargs_t context, cargs_list_cb_t cb, void *user, char delim, const char *name, const char *help)
+{
+    UASSERT(context);
+    UASSERT(cb);
+    ctx_t *ctx = (ctx_t *)context;
+    if (newopt(ctx, name, help, NULL, NULL, delim, 0, CARGS_LIST_CB))
+        return true;
+    opt_t *opt = da_last_item(&ctx->optlist);
+    opt->cb = cb;
+    opt->user = user;
+    return false;
+}
+
+bool
+cargs_add_pos(cargs_t context, char **v, const char *name, const char *help)
+{
+    UASSERT(context);
+    return newpos((ctx_t *)context, name, help, (void *)v, NULL);
+}
+
+bool
+cargs_add_pos_tail(cargs_t context, int **v, int *vlen, const char *name, const char *help)
+{
+    UASSERT(context);
+    UASSERT(vlen);
+    return newpos((ctx_t *)context, name, help, (void *)v, vlen);
+}
+
+void
+cargs_set_lazy(cargs_t context, bool lazy)
+{
+    UASSERT(context);
+    ((ctx_t *)context)->lazy = lazy;
+}
+
+bool
+cargs_get_flag(cargs_t context, const char *name, bool *v)
+{
+    UASSERT(context);
+    UASSERT(v);
+    ctx_t *ctx = (ctx_t *)context;
+    opt_t *opt = lazy_lookup(ctx, name, CARGS_BOOL);
+    if (!opt || lazy_convert(ctx, opt))
+        return true;
+    *v = opt->val.b;
+    return false;
+}
+
+bool
+cargs_get_int(cargs_t context, const char *name, int *v)
+{
+    UASSERT(context);
+    UASSERT(v);
+    ctx_t *ctx = (ctx_t *)context;
+    opt_t *opt = lazy_lookup(ctx, name, CARGS_INT);
+    if (!opt || lazy_convert(ctx, opt))
+        return true;
+    *v = opt->val.i;
+    return false;
+}
+
+bool
+cargs_get_float(cargs_t context, const char *name, float *v)
+{
+    UASSERT(context);
+    UASSERT(v);
+    ctx_t *ctx = (ctx_t *)context;
+    opt_t *opt = lazy_lookup(ctx, name, CARGS_FLOAT);
+    if (!opt || lazy_convert(ctx, opt))
+        return true;
+    *v = opt->val.f;
+    return false;
+}
+
+bool
+cargs_get_str(cargs_t context, const char *name, char **v)
+{
+    UASSERT(context);
+    UASSERT(v);
+    ctx_t *ctx = (ctx_t *)context;
+    opt_t *opt = lazy_lookup(ctx, name, CARGS_STR);
+    if (!opt || lazy_convert(ctx, opt))
+        return true;
+    *v = opt->val.s;
+    return false;
+}
+
+bool
+cargs_get_str_list(cargs_t context, const char *name, char ***v, int *vlen)
+{
+    UASSERT(context);
+    UASSERT(v);
+    UASSERT(vlen);
+    ctx_t *ctx = (ctx_t *)context;
+    opt_t *opt = lazy_lookup(ctx, name, CARGS_LIST);
+    if (!opt || lazy_convert(ctx, opt))
+        return true;
+    *v = opt->val.l;
+    *vlen = opt->vallen;
+    return false;
+}
+
+bool
+cargs_validate(cargs_t context)
+{
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    ctx->errorlog.count = 0;
+
+    bool err = false;
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        opt_t *opt = &ctx->optlist.items[i];
+        if (opt_is_lazy(ctx, opt) && lazy_convert(ctx, opt))
+            err = true;
+    }
+
+    return err;
+}
+
+bool
+cargs_require(cargs_t context, const char *name, ...)
+{
+    UASSERT(context);
+    va_list args;
+    va_start(args, name);
+    bool err = newrule((ctx_t *)context, CARGS_RULE_REQUIRED, name, args);
+    va_end(args);
+    return err;
+}
+
+bool
+cargs_requires(cargs_t context, const char *name, ...)
+{
+    UASSERT(context);
+    va_list args;
+    va_start(args, name);
+    bool err = newrule((ctx_t *)context, CARGS_RULE_REQUIRES, name, args);
+    va_end(args);
+    return err;
+}
+
+bool
+cargs_conflicts(cargs_t context, const char *name, ...)
+{
+    UASSERT(context);
+    va_list args;
+    va_start(args, name);
+    bool err = newrule((ctx_t *)context, CARGS_RULE_CONFLICTS, name, args);
+    va_end(args);
+    return err;
+}
+
+bool
+cargs_one_of(cargs_t context, const char *name, ...)
+{
+    UASSERT(context);
+    va_list args;
+    va_start(args, name);
+    bool err = newrule((ctx_t *)context, CARGS_RULE_ONE_OF, name, args);
+    va_end(args);
+    return err;
+}
+
+const cargs_violation_t *
+cargs_violations(cargs_t context, int *count)
+{
+    UASSERT(context);
+    UASSERT(count);
+    ctx_t *ctx = (ctx_t *)context;
+    *count = ctx->violations.count;
+    return ctx->violations.items;
+}
+
+void
+cargs_set_precount(cargs_t context, bool precount)
+{
+    UASSERT(context);
+    ((ctx_t *)context)->precount = precount;
+}
+
+bool
+cargs_reset_group(cargs_t context, void *base, const char *prefix)
+{
+    UASSERT(context);
+    UASSERT(prefix);
+    ctx_t *ctx = (ctx_t *)context;
+
+    int node = trie_walk(&ctx->trie, prefix, false);
+    if ((node <= 0) || (prefix[ctx->trie.nodes.items[node].pathlen] != '\0')) {
+        ustr_builder_printf(&ctx->errorlog, "Unknown namespace '%s'\n", prefix);
+        return true;
+    }
+
+    // fields are reset in the struct given here, not the last one parsed
+    char *saved = ctx->base;
+    ctx->base = base;
+    reset_node(ctx, node);
+    ctx->base = saved;
+    return false;
+}
+
+bool
+cargs_mount(cargs_t context, const char *prefix, cargs_t group, size_t offset)
+{
+    UASSERT(context);
+    UASSERT(prefix);
+    UASSERT(group);
+    ctx_t *ctx = (ctx_t *)context;
+    ctx_t *grp = (ctx_t *)group;
+
+    if (grp->defimg && (!ctx->defimg || (offset + grp->structsize > ctx->structsize))) {
+        ustr_builder_printf(&ctx->errorlog, "Group mounted at '%s' is out of struct bounds\n", prefix);
+        return true;
+    }
+
+    ustr_builder_t name;
+    ustr_builder_alloc(&name);
+
+    bool err = false;
+    for (int i = 0; !err && (i < grp->optlist.count); i++) {
+        opt_t *src = &grp->optlist.items[i];
+
+        // group flags are relative, their dashes are dropped
+        const char *rel = src->name;
+        while (*rel == '-')
+            rel++;
+
+        name.count = 0;
+        ustr_builder_printf(&name, "%s.%s", prefix, rel);
+        ustr_builder_terminate(&name);
+
+        err = newopt(ctx, name.items, src->help, src->ptr, src->ptrlen, src->delim, src->def, src->dtype);
+        if (err)
+            break;
+
+        opt_t *opt = da_last_item(&ctx->optlist);
+        opt->cb = src->cb;
+        opt->user = src->user;
+        if (src->accum) {
+            opt->accum = true;
+            da_init(&opt->acc, 16 * dtype_size(opt->dtype));
+        }
+        if (src->field) {
+            opt->field = true;
+            opt->offset = offset + src->offset;
+            opt->lenoffset = offset + src->lenoffset;
+            memcpy(ctx->defimg + opt->offset, grp->defimg + src->offset, dtype_size(opt->dtype));
+            if (opt->dtype == CARGS_LIST)
+                memcpy(ctx->defimg + opt->lenoffset, grp->defimg + src->lenoffset, sizeof(int));
+        }
+    }
+
+    ustr_builder_free(&name);
+    return err;
+}
+
+void
+cargs_bind_struct(cargs_t context, size_t size)
+{
+    UASSERT(context);
+    UASSERT(size > 0);
+    ctx_t *ctx = (ctx_t *)context;
+    UASSERT(ctx->defimg == NULL);
+    ctx->defimg = umalloc(size);
+    memset(ctx->defimg, 0, size);
+    ctx->structsize = size;
+}
+
+bool
+cargs_add_field_flag(cargs_t context, size_t offset, bool def, const char *name, const char *help)
+{
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    if (newfield(ctx, name, help, offset, sizeof(bool), 0, '\0', CARGS_BOOL))
+        return true;
+    *(bool *)(ctx->defimg + offset) = def;
+    return false;
+}
+
+bool
+cargs_add_field_int(cargs_t context, size_t offset, int def, const char *name, const char *help)
+{
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    if (newfield(ctx, name, help, offset, sizeof(int), 0, '\0', CARGS_INT))
+        return true;
+    *(int *)(ctx->defimg + offset) = def;
+    return false;
+}
+
+bool
+cargs_add_field_float(cargs_t context, size_t offset, float def, const char *name, const char *help)
+{
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    if (newfield(ctx, name, help, offset, sizeof(float), 0, '\0', CARGS_FLOAT))
+        return true;
+    *(float *)(ctx->defimg + offset) = def;
+    return false;
+}
+
+bool
+cargs_add_field_str(cargs_t context, size_t offset, const char *def, const char *name, const char *help)
+{
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    if (newfield(ctx, name, help, offset, sizeof(char *), 0, '\0', CARGS_STR))
+        return true;
+    *(const char **)(ctx->defimg + offset) = def;
+    return false;
+}
+
+bool
+cargs_add_field_str_list(cargs_t context, size_t offset, size_t lenoffset, char delim, const char *name, const char *help)
+{
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    if (newfield(ctx, name, help, offset, sizeof(char **), lenoffset, delim, CARGS_LIST))
+        return true;
+    *(char ***)(ctx->defimg + offset) = NULL;
+    *(int *)(ctx->defimg + lenoffset) = 0;
+    return false;
+}
+
+const char *
+cargs_help(cargs_t context, const char *name)
+{
+    UASSERT(context);
+    UASSERT(name);
+    ctx_t *ctx = (ctx_t *)context;
+
+    // the arena may move while the message is built
+    size_t start = ctx->arena.count;
+
+    size_t nw = ctx->namemaxlen;
+    size_t hw = ctx->helpmaxlen;
+
+    if ((ctx->poslist.count == 0) && (ctx->postail == NULL)) {
+        ustr_builder_printf(&ctx->arena, "Usage: %s [OPTIONS] command\n\nOptions:\n", name);
+    } else {
+        ustr_builder_printf(&ctx->arena, "Usage: %s [OPTIONS]", name);
+        for (int i = 0; i < ctx->poslist.count; i++)
+            ustr_builder_printf(&ctx->arena, " %s", ctx->poslist.items[i].name);
+        if (ctx->postail)
+            ustr_builder_printf(&ctx->arena, " [%s...]", ctx->postail->name);
+
+        ustr_builder_printf(&ctx->arena, "\n\nArguments:\n");
+        for (int i = 0; i < ctx->poslist.count; i++)
+            ustr_builder_printf(&ctx->arena, "   %-*s   %s\n", nw, ctx->poslist.items[i].name, ctx->poslist.items[i].help);
+        if (ctx->postail)
+            ustr_builder_printf(&ctx->arena, "   %-*s   %s\n", nw, ctx->postail->name, ctx->postail->help);
+
+        ustr_builder_printf(&ctx->arena, "\nOptions:\n");
+    }
+
+    for (int i = 0; i < ctx->flat.count; i++) {
+        opt_t *opt = &ctx->optlist.items[ctx->flat.items[i]];
+        ustr_builder_printf(&ctx->arena, "   %-*s   %s\n", nw, opt->name, opt->help);
+    }
+
+    // namespaced options, one section per namespace
+    help_node(ctx, 0, nw);
+
+    if (*da_last_item(&ctx->arena) == '\n')
+        da_pop(&ctx->arena);
+    ustr_builder_terminate(&ctx->arena);
+
+    return ctx->arena.items + start;
+}
+
+int
+parse_opt_flag(ctx_t *ctx, opt_t *opt, char *arg, void *dst)
+{
+    UASSERT(opt);
+    UASSERT(arg);
+
+    if (opt->namelen == strlen(arg)) {
+        *(bool *)dst = true;
+        return 1;
+    } else {
+        ustr_builder_printf(&ctx->errorlog, "Flag doesn't match (%s) (%s)\n", opt->name, arg);
+        return -1;
+    }
+}
+
+int
+parse_opt_int(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, void *dst)
+{
+    UASSERT(opt);
+    UASSERT(arg);
+
+    size_t arglen = strlen(arg);
+    int rc;
+    long val;
+
+    if (opt->namelen < arglen) {
+        char *end;
+
+        val = (arg[opt->namelen] == '=')
+            ? strtol(arg + opt->namelen + 1, &end, 10)
+            : strtol(arg + opt->namelen, &end, 10);
+
+        // valid integer following flag
+        if (end - arg == arglen) {
+            rc = 1;
+        }
+
+        // invalid character in string following flag
+        else {
+            ustr_builder_printf(&ctx->errorlog, "Invalid character for integer flag\n");
+            ustr_builder_printf(&ctx->errorlog, "%s\n", arg);
+            ustr_builder_printf(&ctx->errorlog, "%*s\n", end - arg + 1, "^");
+            rc = -1;
+        }
+    }
+
+    // missing operand
+    else if (nextarg == NULL) {
+        ustr_builder_printf(&ctx->errorlog, "Missing operand for flag '%s'\n", arg);
+        rc = -1;
+    }
+
+    // check nextarg
+    else {
+        char *end;
+        val = strtol(nextarg, &end, 10);
+
+        if (end - nextarg != strlen(nextarg)) {
+            ustr_builder_printf(&ctx->errorlog, "Invalid character for integer flag '%s'\n", arg);
+            ustr_builder_printf(&ctx->errorlog, "%s\n", nextarg);
+            ustr_builder_printf(&ctx->errorlog, "%*s\n", end - nextarg + 1, "^");
+            rc = -1;
+        } else {
+            rc = 2;
+        }
+    }
+
+    if (rc > 0)
+        *(int *)dst = val;
+
+    return rc;
+}
+
+int
+parse_opt_float(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, void *dst)
+{
+    UASSERT(opt);
+    UASSERT(arg);
+
+    size_t arglen = strlen(arg);
+    int rc;
+    float val;
+
+    if (opt->namelen < arglen) {
+        char *end;
+
+        val = (arg[opt->namelen] == '=')
+            ? strtof(arg + opt->namelen + 1, &end)
+            : strtof(arg + opt->namelen, &end);
+
+        // valid float following flag
+        if (end - arg == arglen) {
+            rc = 1;
+        }
+
+        // invalid character in string following flag
+        else {
+            ustr_builder_printf(&ctx->errorlog, "Invalid character for float flag\n");
+            ustr_builder_printf(&ctx->errorlog, "%s\n", arg);
+            ustr_builder_printf(&ctx->errorlog, "%*s\n", end - arg + 1, "^");
+            rc = -1;
+        }
+    }
+
+    // missing operand
+    else if (nextarg == NULL) {
+        ustr_builder_printf(&ctx->errorlog, "Missing operand for flag '%s'\n", arg);
+        rc = -1;
+    }
+
+    // check nextarg
+    else {
+        char *end;
+        val = strtof(nextarg, &end);
+
+        if (end - nextarg != strlen(nextarg)) {
+            ustr_builder_printf(&ctx->errorlog, "Invalid character for float flag '%s'\n", arg);
+            ustr_builder_printf(&ctx->errorlog, "%s\n", nextarg);
+            ustr_builder_printf(&ctx->errorlog, "%*s\n", end - nextarg + 1, "^");
+            rc = -1;
+        } else {
+            rc = 2;
+        }
+    }
+
+    if (rc > 0)
+        *(float *)dst = val;
+
+    return rc;
+}
+
+int
+parse_opt_str(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, void *dst)
+{
+    UASSERT(opt);
+    UASSERT(arg);
+
+    size_t arglen = strlen(arg);
+    int rc;
+    char *s;
+
+    if (opt->namelen < arglen) {
+
+        s = (arg[opt->namelen] == '=')
+            ? arg + opt->namelen + 1
+            : arg + opt->namelen;
+
+        rc = 1;
+    }
+
+    // missing operand
+    else if (nextarg == NULL) {
+        ustr_builder_printf(&ctx->errorlog, "Missing operand for flag '%s'\n", opt->name);
+        rc = -1;
+    }
+
+    // check nextarg
+    else {
+        s = nextarg;
+        rc = 2;
+    }
+
+    if (rc > 0)
+        *(char **)dst = s;
+
+    return rc;
+}
+
+int
+parse_opt_span(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg)
+{
+    UASSERT(opt);
+    UASSERT(arg);
+
+    int rc;
+
+    if (opt->namelen < strlen(arg)) {
+        rc = 1;
+    }
+
+    // missing operand
+    else if (nextarg == NULL) {
+        ustr_builder_printf(&ctx->errorlog, "Missing operand for flag '%s'\n", opt->name);
+        rc = -1;
+    }
+
+    else {
+        rc = 2;
+    }
+
+    if (rc > 0) {
+        opt->arg = arg;
+        opt->nextarg = nextarg;
+    }
+
+    return rc;
+}
+
+int
+parse_opt(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg, void *dst, int *dstlen)
+{
+    int n;
+
+    switch (opt->dtype) {
+    case CARGS_BOOL: n = parse_opt_flag(ctx, opt, arg, dst); break;
+    case CARGS_INT: n = parse_opt_int(ctx, opt, arg, nextarg, dst); break;
+    case CARGS_FLOAT: n = parse_opt_float(ctx, opt, arg, nextarg, dst); break;
+    case CARGS_STR: n = parse_opt_str(ctx, opt, arg, nextarg, dst); break;
+    case CARGS_LIST: n = parse_opt_str_list(ctx, opt, arg, nextarg, dst, dstlen); break;
+    case CARGS_LIST_CB: n = parse_opt_list_cb(ctx, opt, arg, nextarg); break;
+    default:
+        UASSERT(0 && "unreachable");
+        n = -1;
+        break;
+    }
+
+    return n;
+}
+
+void
+precount_tokens(ctx_t *ctx, int argc, char **argv)
+{
+    for (int i = 0; i < argc; i++) {
+        if ((argv[i][0] != '-') || (argv[i][1] == '\0'))
+            continue;
+        if (0 == strcmp(argv[i], "--"))
+            break;
+
+        int optidx = optlist_best_match_name(ctx, argv[i]);
+        if ((optidx >= 0) && ctx->optlist.items[optidx].accum) {
+            opt_t *opt = &ctx->optlist.items[optidx];
+            opt->acc.count += dtype_size(opt->dtype);
+        }
+    }
+}
+
+void
+precount(ctx_t *ctx, int argc, char **argv)
+{
+    // counts every token that resolves to a repeatable option, in argv and
+    // in the config files. Tokens that end up as operands of other flags are
+    // counted too, so the result is an upper bound and the buffers are never
+    // grown during parsing.
+    precount_tokens(ctx, argc, argv);
+    for (int i = 0; i < ctx->sources.count; i++)
+        precount_tokens(ctx, ctx->sources.items[i].tokens.count, ctx->sources.items[i].tokens.items);
+
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        opt_t *opt = &ctx->optlist.items[i];
+        if (!opt->accum)
+            continue;
+        if (opt->acc.count > opt->acc.capacity)
+            da_resize(&opt->acc, opt->acc.count);
+        opt->acc.count = 0;
+    }
+}
+
+bool
+parse_operands(ctx_t *ctx, char **argv)
+{
+    idxlist_t *ops = &ctx->operands;
+    poslist_t *slots = &ctx->poslist;
+
+    if (ops->count < slots->count) {
+        ustr_builder_printf(&ctx->errorlog, "Missing argument '%s'\n", slots->items[ops->count].name);
+        return true;
+    }
+
+    if ((ops->count > slots->count) && (ctx->postail == NULL)) {
+        ustr_builder_printf(&ctx->errorlog, "Unexpected argument '%s'\n", argv[ops->items[slots->count]]);
+        return true;
+    }
+
+    for (int i = 0; i < slots->count; i++)
+        *(char **)slots->items[i].ptr = argv[ops->items[i]];
+
+    if (ctx->postail) {
+        *(int **)ctx->postail->ptr = ops->items + slots->count;
+        *ctx->postail->ptrlen = ops->count - slots->count;
+    }
+
+    return false;
+}
+
+bool
+parse_tokens(ctx_t *ctx, int argc, char **argv, bool operands)
+{
+    bool endopts = false;
+
+    for (int i = 0; i < argc; ) {
+        char *arg = argv[i];
+        char *nextarg = ((i + 1) < argc) ? argv[i+1] : NULL;
+
+        // operands skip the option lookup, "-" alone is an operand too
+        if (endopts || (arg[0] != '-') || (arg[1] == '\0')) {
+            if (!operands) {
+                ustr_builder_printf(&ctx->errorlog, "Unexpected argument '%s'\n", arg);
+                return true;
+            }
+            ctx->operands.items[ctx->operands.count++] = i++;
+            continue;
+        }
+
+        // "--" terminates the options
+        if ((arg[1] == '-') && (arg[2] == '\0')) {
+            endopts = true;
+            i++;
+            continue;
+        }
+
+        int optidx = optlist_best_match_name(ctx, arg);
+        if (optidx < 0) {
+            ustr_builder_printf(&ctx->errorlog, "Unknown flag '%s'\n", arg);
+            return true;
+        }
+
+        opt_t *opt = &ctx->optlist.items[optidx];
+
+        if (!opt->accum && opt_present(ctx, opt)) {
+            ustr_builder_printf(&ctx->errorlog, "Duplicate flag '%s'\n", opt->name);
+            return true;
+        }
+
+        int n;
+
+        // a reload only recomputes struct fields, other options are skipped
+        if (ctx->reloading && !opt->field) {
+            n = (opt->dtype == CARGS_BOOL) ? 1 : parse_opt_span(ctx, opt, arg, nextarg);
+        }
+
+        // repeatable options append into their buffer
+        else if (opt->accum) {
+            size_t size = dtype_size(opt->dtype);
+            if (opt->acc.count + size > opt->acc.capacity)
+                da_reserve(&opt->acc, size);
+            n = parse_opt(ctx, opt, arg, nextarg, da_endptr(&opt->acc), NULL);
+        }
+
+        // lazy options only record their span, flags have nothing to convert
+        else if (opt_is_lazy(ctx, opt)) {
+            if (opt->dtype == CARGS_BOOL) {
+                n = parse_opt_flag(ctx, opt, arg, &opt->val);
+                opt->converted = true;
+            } else {
+                n = parse_opt_span(ctx, opt, arg, nextarg);
+            }
+        }
+
+        else {
+            n = parse_opt(ctx, opt, arg, nextarg, opt_ptr(ctx, opt), opt_ptrlen(ctx, opt));
+        }
+
+        // error
+        if (n < 0)
+            return true;
+
+        // a reload only skips repeatable options, nothing was appended
+        if (opt->accum && !ctx->reloading)
+            opt->acc.count += dtype_size(opt->dtype);
+
+        opt_set_present(ctx, opt, true);
+        i += n;
+    }
+
+    return false;
+}
+
+bool
+parse_fresh(ctx_t *ctx, int argc, char **argv)
+{
+    // a parse that fails before the rules run reports no violations
+    ctx->violations.count = 0;
+
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        ctx->optlist.items[i].converted = false;
+        ctx->optlist.items[i].acc.count = 0;
+    }
+
+    if (ctx->precount)
+        precount(ctx, argc, argv);
+
+    // every token may be an operand, size the index array once
+    ctx->operands.count = 0;
+    if (ctx->operands.capacity < argc)
+        da_resize(&ctx->operands, argc);
+
+    // field defaults are applied in one go, parsed fields overwrite them
+    if (ctx->defimg && !ctx->lazy) {
+        UASSERT(ctx->base && "struct-bound options need cargs_parse_struct");
+        memcpy(ctx->base, ctx->defimg, ctx->structsize);
+    }
+
+    // config files first so argv overrides them
+    if (apply_sources(ctx))
+        return true;
+
+    memset(ctx->present.items, 0, ctx->present.count * sizeof(uint64_t));
+    if (parse_tokens(ctx, argc, argv, true))
+        return true;
+
+    for (int i = 0; i < ctx->present.count; i++) {
+        ctx->argvpresent.items[i] = ctx->present.items[i];
+        ctx->present.items[i] |= ctx->srcpresent.items[i];
+    }
+
+    if (parse_operands(ctx, argv))
+        return true;
+
+    if (check_rules(ctx))
+        return true;
+
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        opt_t *opt = &ctx->optlist.items[i];
+
+        // buffers may have moved while growing, publish them last
+        if (opt->accum) {
+            *(void **)opt->ptr = opt_present(ctx, opt) ? (void *)opt->acc.items : NULL;
+            *opt->ptrlen = opt->acc.count / dtype_size(opt->dtype);
+            continue;
+        }
+
+        if (opt->field || opt_is_lazy(ctx, opt) || opt_present(ctx, opt))
+            continue;
+
+        opt_default(ctx, opt, opt->ptr, opt->ptrlen);
+    }
+
+    return false;
+}
+
+bool
+parse(ctx_t *ctx, int argc, char **argv)
+{
+    ctx->errorlog.count = 0;
+
+    for (int i = 0; i < ctx->lists.count; i++)
+        free(ctx->lists.items[i]);
+    ctx->lists.count = 0;
+
+    // the buffers of the last parse may still back the published block
+    for (int i = 0; i < ctx->sources.count; i++) {
+        source_t *src = &ctx->sources.items[i];
+        if (src->parsebuf && (src->parsebuf != src->buf))
+            da_append(&ctx->stale, src->parsebuf);
+        src->parsebuf = src->buf;
+    }
+
+    if (!cache_usable(ctx))
+        return parse_fresh(ctx, argc, argv);
+
+    uint64_t hash = argv_hash(argc, argv);
+    centry_t *e = cache_find(ctx, hash, argc, argv);
+    if (e) {
+        ctx->cache.hits++;
+        return cache_hit(ctx, e, argv);
+    }
+
+    ctx->cache.misses++;
+    bool err = parse_fresh(ctx, argc, argv);
+    cache_store(ctx, hash, argc, argv, err);
+    return err;
+}
+
+bool
+cargs_parse(cargs_t context, const char *name, int argc, char **argv)
+{
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    ctx->base = NULL;
+    return parse(ctx, argc, argv);
+}
+
+bool
+cargs_parse_struct(cargs_t context, void *base, const char *name, int argc, char **argv)
+{
+    UASSERT(context);
+    UASSERT(base);
+    ctx_t *ctx = (ctx_t *)context;
+    ctx->base = base;
+    return parse(ctx, argc, argv);
+}
+
+uint64_t
+schema_hash(ctx_t *ctx)
+{
+    // FNV-1a over everything that determines the image layout
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        opt_t *opt = &ctx->optlist.items[i];
+        unsigned char key[4] = { opt->dtype, opt->accum, opt->field, opt->delim };
+        for (int j = 0; j <= opt->namelen; j++)
+            h = (h ^ (unsigned char)opt->name[j]) * 0x100000001b3ull;
+        for (int j = 0; j < sizeof(key); j++)
+            h = (h ^ key[j]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+uint64_t
+snap_reserve(snapw_t *w, size_t len, size_t align)
+{
+    w->pos = (w->pos + align - 1) & ~(align - 1);
+    uint64_t off = w->pos;
+    w->pos += len;
+    return off;
+}
+
+void
+snap_set(snapw_t *w, uint64_t off, const void *p, size_t len)
+{
+    if (off + len <= w->size)
+        memcpy(w->buf + off, p, len);
+}
+
+uint64_t
+snap_put_str(snapw_t *w, const char *s)
+{
+    if (s == NULL)
+        return SNAP_NULL;
+    size_t len = strlen(s) + 1;
+    uint64_t off = snap_reserve(w, len, 1);
+    snap_set(w, off, s, len);
+    return off;
+}
+
+uint64_t
+snap_put_str_list(snapw_t *w, char **items, int count)
+{
+    uint64_t off = snap_reserve(w, count * sizeof(uint64_t), sizeof(uint64_t));
+    for (int i = 0; i < count; i++) {
+        uint64_t s = snap_put_str(w, items[i]);
+        snap_set(w, off + i * sizeof(uint64_t), &s, sizeof(s));
+    }
+    return off;
+}
+
+bool
+snap_write_opt(ctx_t *ctx, snapw_t *w, opt_t *opt, snaprec_t *rec)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->present = opt_present(ctx, opt);
+    rec->dtype = opt->dtype;
+
+    // streaming lists only have a presence bit
+    if (opt->dtype == CARGS_LIST_CB)
+        return false;
+
+    if (opt->accum) {
+        size_t size = dtype_size(opt->dtype);
+        rec->count = opt->acc.count / size;
+        if (opt->dtype == CARGS_STR) {
+            rec->value = snap_put_str_list(w, (char **)opt->acc.items, rec->count);
+        } else {
+            rec->value = snap_reserve(w, opt->acc.count, sizeof(uint64_t));
+            snap_set(w, rec->value, opt->acc.items, opt->acc.count);
+        }
+        return false;
+    }
+
+    void *v;
+    int *vlen;
+    if (opt_is_lazy(ctx, opt)) {
+        if (lazy_convert(ctx, opt))
+            return true;
+        v = &opt->val;
+        vlen = &opt->vallen;
+    } else {
+        v = opt_ptr(ctx, opt);
+        vlen = opt_ptrlen(ctx, opt);
+    }
+
+    switch (opt->dtype) {
+    case CARGS_BOOL:
+        rec->value = *(bool *)v;
+        break;
+    case CARGS_INT:
+        rec->value = (uint32_t)*(int *)v;
+        break;
+    case CARGS_FLOAT:
+        memcpy(&rec->value, v, sizeof(float));
+        break;
+    case CARGS_STR:
+        rec->value = snap_put_str(w, *(char **)v);
+        break;
+    case CARGS_LIST:
+        rec->count = *vlen;
+        rec->value = snap_put_str_list(w, *(char ***)v, *vlen);
+        break;
+    default:
+        break;
+    }
+
+    return false;
+}
+
+const char *
+snap_str(const char *img, uint64_t off)
+{
+    if (off == SNAP_NULL)
+        return NULL;
+    return img + off;
+}
+
+bool
+snap_check(ctx_t *ctx, const char *img, size_t size)
+{
+    snaphdr_t hdr;
+    size_t recend = sizeof(hdr) + ctx->optlist.count * sizeof(snaprec_t);
+
+    if (size < sizeof(hdr)) {
+        ustr_builder_printf(&ctx->errorlog, "Invalid snapshot\n");
+        return true;
+    }
+
+    memcpy(&hdr, img, sizeof(hdr));
+
+    if ((0 != memcmp(hdr.magic, SNAP_MAGIC, 4)) || (hdr.size > size) || (hdr.size < recend)) {
+        ustr_builder_printf(&ctx->errorlog, "Invalid snapshot\n");
+        return true;
+    }
+
+    if ((hdr.version != SNAP_VERSION) || (hdr.schema != schema_hash(ctx)) || (hdr.count != ctx->optlist.count)) {
+        ustr_builder_printf(&ctx->errorlog, "Snapshot doesn't match the registered options\n");
+        return true;
+    }
+
+    // validate every offset so a corrupt image can't send us out of bounds
+    size = hdr.size;
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        opt_t *opt = &ctx->optlist.items[i];
+        snaprec_t rec;
+        memcpy(&rec, img + sizeof(hdr) + i * sizeof(rec), sizeof(rec));
+
+        bool strs = (opt->dtype == CARGS_LIST) || (opt->accum && (opt->dtype == CARGS_STR));
+        bool str = !opt->accum && (opt->dtype == CARGS_STR);
+        size_t esize = strs ? sizeof(uint64_t) : opt->accum ? dtype_size(opt->dtype) : 0;
+
+        bool ok = rec.dtype == opt->dtype;
+        if (ok && (strs || opt->accum)) {
+            ok = (rec.value <= size) && (rec.count <= (size - rec.value) / esize) &&
+                 (((uintptr_t)img + rec.value) % sizeof(uint64_t) == 0);
+        }
+        if (ok && str && (rec.value != SNAP_NULL))
+            ok = (rec.value < size) && memchr(img + rec.value, '\0', size - rec.value);
+        for (uint32_t j = 0; ok && strs && (j < rec.count); j++) {
+            uint64_t off;
+            memcpy(&off, img + rec.value + j * sizeof(off), sizeof(off));
+            ok = (off == SNAP_NULL) || ((off < size) && memchr(img + off, '\0', size - off));
+        }
+
+        if (!ok) {
+            ustr_builder_printf(&ctx->errorlog, "Invalid snapshot record for flag '%s'\n", opt->name);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t
+snap_count_strs(ctx_t *ctx, const char *img)
+{
+    size_t nstrs = 0;
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        opt_t *opt = &ctx->optlist.items[i];
+        snaprec_t rec;
+        memcpy(&rec, img + sizeof(snaphdr_t) + i * sizeof(rec), sizeof(rec));
+        if ((opt->dtype == CARGS_LIST) || (opt->accum && (opt->dtype == CARGS_STR)))
+            nstrs += rec.count;
+    }
+    return nstrs;
+}
+
+// the string arrays of the image are stored as offsets, rebuild them as
+// pointers into the image, one after the other in option order
+void
+snap_build_arrays(ctx_t *ctx, const char *img, char **strs)
+{
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        opt_t *opt = &ctx->optlist.items[i];
+        snaprec_t rec;
+        memcpy(&rec, img + sizeof(snaphdr_t) + i * sizeof(rec), sizeof(rec));
+        if ((opt->dtype != CARGS_LIST) && !(opt->accum && (opt->dtype == CARGS_STR)))
+            continue;
+        for (uint32_t j = 0; j < rec.count; j++) {
+            uint64_t off;
+            memcpy(&off, img + rec.value + j * sizeof(off), sizeof(off));
+            *strs++ = (char *)snap_str(img, off);
+        }
+    }
+}
+
+// `strs` is the rebuilt array of this option, NULL if it has none
+void
+snap_read_opt(ctx_t *ctx, const char *img, opt_t *opt, snaprec_t *rec, char **strs)
+{
+    opt_set_present(ctx, opt, rec->present);
+
+    if (opt->dtype == CARGS_LIST_CB)
+        return;
+
+    // values go back into the buffer so a later snapshot sees them, then
+    // they are published like after a parse
+    if (opt->accum) {
+        size_t size = rec->count * dtype_size(opt->dtype);
+        opt->acc.count = 0;
+        da_reserve(&opt->acc, size);
+        memcpy(opt->acc.items, strs ? (void *)strs : (void *)(img + rec->value), size);
+        opt->acc.count = size;
+        *(void **)opt->ptr = rec->present ? (void *)opt->acc.items : NULL;
+        *opt->ptrlen = rec->count;
+        return;
+    }
+
+    void *v;
+    int *vlen;
+    if (opt_is_lazy(ctx, opt)) {
+        opt->converted = true;
+        v = &opt->val;
+        vlen = &opt->vallen;
+    } else {
+        v = opt_ptr(ctx, opt);
+        vlen = opt_ptrlen(ctx, opt);
+    }
+
+    switch (opt->dtype) {
+    case CARGS_BOOL:
+        *(bool *)v = rec->value;
+        break;
+    case CARGS_INT:
+        *(int *)v = (int)(uint32_t)rec->value;
+        break;
+    case CARGS_FLOAT:
+        memcpy(v, &rec->value, sizeof(float));
+        break;
+    case CARGS_STR:
+        *(char **)v = (char *)snap_str(img, rec->value);
+        break;
+    case CARGS_LIST:
+        *(char ***)v = strs;
+        *vlen = rec->count;
+        break;
+    default:
+        break;
+    }
+}
+
+// `strs` holds the arrays built by snap_build_arrays for this image
+void
+restore_image(ctx_t *ctx, const char *img, char **strs)
+{
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        opt_t *opt = &ctx->optlist.items[i];
+        snaprec_t rec;
+        memcpy(&rec, img + sizeof(snaphdr_t) + i * sizeof(rec), sizeof(rec));
+        if ((opt->dtype == CARGS_LIST) || (opt->accum && (opt->dtype == CARGS_STR))) {
+            snap_read_opt(ctx, img, opt, &rec, strs);
+            strs += rec.count;
+        } else {
+            snap_read_opt(ctx, img, opt, &rec, NULL);
+        }
+    }
+}
+
+bool
+restore(ctx_t *ctx, const void *buf, size_t size)
+{
+    UASSERT(buf);
+
+    ctx->errorlog.count = 0;
+
+    if (snap_check(ctx, buf, size))
+        return true;
+
+    // one allocation for every string array in the image
+    size_t nstrs = snap_count_strs(ctx, buf);
+    ctx->restorebuf.count = 0;
+    if (ctx->restorebuf.capacity < nstrs)
+        da_resize(&ctx->restorebuf, nstrs);
+    snap_build_arrays(ctx, buf, ctx->restorebuf.items);
+    ctx->restorebuf.count = nstrs;
+
+    restore_image(ctx, buf, ctx->restorebuf.items);
+    return false;
+}
+
+size_t
+snapshot(ctx_t *ctx, void *buf, size_t size)
+{
+    snapw_t w = { buf, size, 0 };
+
+    snaphdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAP_MAGIC, 4);
+    hdr.version = SNAP_VERSION;
+    hdr.schema = schema_hash(ctx);
+    hdr.count = ctx->optlist.count;
+
+    snap_reserve(&w, sizeof(hdr), 1);
+    uint64_t recs = snap_reserve(&w, hdr.count * sizeof(snaprec_t), 1);
+
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        snaprec_t rec;
+        if (snap_write_opt(ctx, &w, &ctx->optlist.items[i], &rec))
+            return 0;
+        snap_set(&w, recs + i * sizeof(rec), &rec, sizeof(rec));
+    }
+
+    hdr.size = w.pos;
+    snap_set(&w, 0, &hdr, sizeof(hdr));
+
+    return w.pos;
+}
+
+size_t
+cargs_snapshot(cargs_t context, void *buf, size_t size)
+{
+    UASSERT(context);
+    UASSERT(buf || (size == 0));
+    return snapshot((ctx_t *)context, buf, size);
+}
+
+bool
+cargs_restore(cargs_t context, const void *buf, size_t size)
+{
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    UASSERT((!ctx->defimg || ctx->lazy) && "struct-bound options need cargs_restore_struct");
+    ctx->base = NULL;
+    return restore(ctx, buf, size);
+}
+
+bool
+cargs_restore_struct(cargs_t context, void *base, const void *buf, size_t size)
+{
+    UASSERT(context);
+    UASSERT(base);
+    ctx_t *ctx = (ctx_t *)context;
+    ctx->base = base;
+    return restore(ctx, buf, size);
+}
+
+bool
+source_read(ctx_t *ctx, source_t *src)
+{
+    FILE *f = fopen(src->path, "rb");
+    if (f == NULL) {
+        ustr_builder_printf(&ctx->errorlog, "Can't open config file '%s'\n", src->path);
+        return true;
+    }
+
+    ustr_builder_t b;
+    ustr_builder_alloc(&b);
+    for (;;) {
+        da_reserve(&b, 4096);
+        size_t n = fread(da_endptr(&b), 1, b.capacity - b.count - 1, f);
+        if (n == 0)
+            break;
+        b.count += n;
+    }
+    bool err = ferror(f);
+    fclose(f);
+
+    if (err) {
+        ustr_builder_free(&b);
+        ustr_builder_printf(&ctx->errorlog, "Can't read config file '%s'\n", src->path);
+        return true;
+    }
+
+    ustr_builder_terminate(&b);
+
+    // tokens are whitespace separated, '#' comments out the rest of a line
+    src->tokens.count = 0;
+    for (char *c = b.items; *c; ) {
+        if ((*c == ' ') || (*c == '\t') || (*c == '\n') || (*c == '\r')) {
+            *c++ = '\0';
+        } else if (*c == '#') {
+            while (*c && (*c != '\n'))
+                *c++ = '\0';
+        } else {
+            da_append(&src->tokens, c);
+            while (*c && (*c != ' ') && (*c != '\t') && (*c != '\n') && (*c != '\r') && (*c != '#'))
+                c++;
+        }
+    }
 
-    if (opt->namelen == strlen(arg)) {
-        *(bool *)opt->ptr = true;
-        return 1;
+    // values of the published block may still point into the old buffer,
+    // the one of the last parse is kept until the next parse
+    if ((ctx->watchfd >= 0) && src->buf) {
+        if (src->buf != src->parsebuf)
+            da_append(&ctx->stale, src->buf);
     } else {
-        ustr_builder_printf(&ctx->errorlog, "Flag doesn't match (%s) (%s)\n", opt->name, arg);
-        return -1;
+        free(src->buf);
     }
+    src->buf = ustr_builder_leak(&b);
+
+    return false;
 }
 
-int
-parse_opt_int(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg)
+bool
+apply_sources(ctx_t *ctx)
 {
-    UASSERT(opt);
-    UASSERT(arg);
+    size_t words = ctx->present.count * sizeof(uint64_t);
+    memset(ctx->srcpresent.items, 0, words);
+
+    // every file starts from a clean slate so later files override earlier ones
+    for (int i = 0; i < ctx->sources.count; i++) {
+        source_t *src = &ctx->sources.items[i];
+        memset(ctx->present.items, 0, words);
+        if (parse_tokens(ctx, src->tokens.count, src->tokens.items, false)) {
+            ustr_builder_printf(&ctx->errorlog, "in config file '%s'\n", src->path);
+            return true;
+        }
+        for (int w = 0; w < ctx->present.count; w++)
+            ctx->srcpresent.items[w] |= ctx->present.items[w];
+    }
 
-    size_t arglen = strlen(arg);
-    int rc;
-    long val;
+    return false;
+}
 
-    if (opt->namelen < arglen) {
-        char *end;
+bool
+field_equal(opt_t *opt, const char *a, const char *b)
+{
+    a += opt->offset;
+    b += opt->offset;
+
+    switch (opt->dtype) {
+    case CARGS_STR: {
+        const char *sa = *(char **)a;
+        const char *sb = *(char **)b;
+        return (sa == sb) || (sa && sb && (0 == strcmp(sa, sb)));
+    }
+    case CARGS_LIST: {
+        char **la = *(char ***)a;
+        char **lb = *(char ***)b;
+        int n = *(int *)(a - opt->offset + opt->lenoffset);
+        if (n != *(int *)(b - opt->offset + opt->lenoffset))
+            return false;
+        for (int i = 0; i < n; i++)
+            if (0 != strcmp(la[i], lb[i]))
+                return false;
+        return true;
+    }
+    default:
+        return 0 == memcmp(a, b, dtype_size(opt->dtype));
+    }
+}
 
-        val = (arg[opt->namelen] == '=')
-            ? strtol(arg + opt->namelen + 1, &end, 10)
-            : strtol(arg + opt->namelen, &end, 10);
+void
+retire(ctx_t *ctx, void *p)
+{
+    if (p)
+        da_append(&ctx->retired, p);
+}
 
-        // valid integer following flag
-        if (end - arg == arglen) {
-            rc = 1;
-        }
+char **
+list_dup(char **list, int n)
+{
+    size_t size = 0;
+    for (int i = 0; i < n; i++)
+        size += strlen(list[i]) + 1;
+
+    // same layout as parse_opt_str_list, pointers first then the strings
+    char **dup = umalloc(n * sizeof(char *) + size);
+    char *strs = (char *)(dup + n);
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(list[i]) + 1;
+        dup[i] = memcpy(strs, list[i], len);
+        strs += len;
+    }
+    return dup;
+}
 
-        // invalid character in string following flag
-        else {
-            ustr_builder_printf(&ctx->errorlog, "Invalid character for integer flag\n");
-            ustr_builder_printf(&ctx->errorlog, "%s\n", arg);
-            ustr_builder_printf(&ctx->errorlog, "%*s\n", end - arg + 1, "^");
-            rc = -1;
-        }
+bool
+cargs_load_file(cargs_t context, const char *path)
+{
+    UASSERT(context);
+    UASSERT(path);
+    ctx_t *ctx = (ctx_t *)context;
+
+    source_t src;
+    memset(&src, 0, sizeof(src));
+    src.path = umalloc(strlen(path) + 1);
+    strcpy(src.path, path);
+    const char *slash = strrchr(src.path, '/');
+    src.basename = slash ? slash + 1 : src.path;
+    src.wd = -1;
+    da_init(&src.tokens, 16);
+
+    if (source_read(ctx, &src)) {
+        free(src.path);
+        da_delete(&src.tokens);
+        return true;
     }
 
-    // missing operand
-    else if (nextarg == NULL) {
-        ustr_builder_printf(&ctx->errorlog, "Missing operand for flag '%s'\n", arg);
-        rc = -1;
+    da_append(&ctx->sources, src);
+    cache_clear(ctx);
+
+    return false;
+}
+
+bool
+cargs_watch(cargs_t context, int *fd)
+{
+    UASSERT(context);
+    UASSERT(fd);
+    ctx_t *ctx = (ctx_t *)context;
+    UASSERT(ctx->base && ctx->defimg && !ctx->lazy && "hot reload needs cargs_parse_struct");
+    UASSERT(ctx->watchfd < 0);
+
+    ctx->watchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ctx->watchfd < 0) {
+        ustr_builder_printf(&ctx->errorlog, "Can't watch config files: %s\n", strerror(errno));
+        return true;
     }
 
-    // check nextarg
-    else {
-        char *end;
-        val = strtol(nextarg, &end, 10);
+    for (int i = 0; i < ctx->sources.count; i++) {
+        source_t *src = &ctx->sources.items[i];
 
-        if (end - nextarg != strlen(nextarg)) {
-            ustr_builder_printf(&ctx->errorlog, "Invalid character for integer flag '%s'\n", arg);
-            ustr_builder_printf(&ctx->errorlog, "%s\n", nextarg);
-            ustr_builder_printf(&ctx->errorlog, "%*s\n", end - nextarg + 1, "^");
-            rc = -1;
-        } else {
-            rc = 2;
+        // split the path at its last slash to watch the parent directory
+        const char *dir = ".";
+        char *slash = (src->basename != src->path) ? (char *)src->basename - 1 : NULL;
+        if (slash) {
+            *slash = '\0';
+            dir = (slash == src->path) ? "/" : src->path;
+        }
+
+        src->wd = inotify_add_watch(ctx->watchfd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+
+        if (slash)
+            *slash = '/';
+
+        if (src->wd < 0) {
+            ustr_builder_printf(&ctx->errorlog, "Can't watch config file '%s': %s\n", src->path, strerror(errno));
+            close(ctx->watchfd);
+            ctx->watchfd = -1;
+            return true;
         }
     }
 
-    if (rc > 0)
-        *(int *)opt->ptr = val;
+    // lists of the parsed struct are freed by the next parse, the published
+    // block gets its own copies
+    char *block = umalloc(ctx->structsize);
+    memcpy(block, ctx->base, ctx->structsize);
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        opt_t *opt = &ctx->optlist.items[i];
+        char ***l = (char ***)(block + opt->offset);
+        if (opt->field && (opt->dtype == CARGS_LIST) && *l)
+            *l = list_dup(*l, *(int *)(block + opt->lenoffset));
+    }
+    atomic_store_explicit(&ctx->current, block, memory_order_release);
+    ctx->scratch = umalloc(ctx->structsize);
 
-    return rc;
+    *fd = ctx->watchfd;
+    return false;
 }
 
-int
-parse_opt_float(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg)
+bool
+cargs_reload(cargs_t context, int *nchanged)
 {
-    UASSERT(opt);
-    UASSERT(arg);
-
-    size_t arglen = strlen(arg);
-    int rc;
-    float val;
-
-    if (opt->namelen < arglen) {
-        char *end;
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    UASSERT(ctx->watchfd >= 0);
 
-        val = (arg[opt->namelen] == '=')
-            ? strtof(arg + opt->namelen + 1, &end)
-            : strtof(arg + opt->namelen, &end);
+    ctx->errorlog.count = 0;
+    if (nchanged)
+        *nchanged = 0;
 
-        // valid float following flag
-        if (end - arg == arglen) {
-            rc = 1;
+    char evbuf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool dirty = false;
+    for (;;) {
+        ssize_t len = read(ctx->watchfd, evbuf, sizeof(evbuf));
+        if (len <= 0)
+            break;
+        for (char *p = evbuf; p < evbuf + len; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            for (int i = 0; i < ctx->sources.count; i++) {
+                source_t *src = &ctx->sources.items[i];
+                if ((ev->wd == src->wd) && ev->len && (0 == strcmp(ev->name, src->basename))) {
+                    src->dirty = true;
+                    dirty = true;
+                }
+            }
+            p += sizeof(struct inotify_event) + ev->len;
         }
+    }
 
-        // invalid character in string following flag
-        else {
-            ustr_builder_printf(&ctx->errorlog, "Invalid character for float flag\n");
-            ustr_builder_printf(&ctx->errorlog, "%s\n", arg);
-            ustr_builder_printf(&ctx->errorlog, "%*s\n", end - arg + 1, "^");
-            rc = -1;
+    if (!dirty)
+        return false;
+
+    // only the changed files are read and tokenized again, results cached
+    // with the old contents are dropped
+    cache_clear(ctx);
+    for (int i = 0; i < ctx->sources.count; i++) {
+        source_t *src = &ctx->sources.items[i];
+        if (src->dirty) {
+            src->dirty = false;
+            if (source_read(ctx, src))
+                return true;
         }
     }
 
-    // missing operand
-    else if (nextarg == NULL) {
-        ustr_builder_printf(&ctx->errorlog, "Missing operand for flag '%s'\n", arg);
-        rc = -1;
-    }
+    char *cur = atomic_load_explicit(&ctx->current, memory_order_relaxed);
+    char *scratch = ctx->scratch;
+
+    // the presence bits of the published block are kept if a file fails
+    size_t words = ctx->srcpresent.count * sizeof(uint64_t);
+    uint64_t *srcpresent = umalloc(words);
+    memcpy(srcpresent, ctx->srcpresent.items, words);
+
+    char *base = ctx->base;
+    memcpy(scratch, ctx->defimg, ctx->structsize);
+    ctx->base = scratch;
+    ctx->reloading = true;
+    bool err = apply_sources(ctx);
+    ctx->reloading = false;
+    ctx->base = base;
+    if (err)
+        memcpy(ctx->srcpresent.items, srcpresent, words);
+    free(srcpresent);
+
+    for (int i = 0; i < ctx->present.count; i++)
+        ctx->present.items[i] = ctx->argvpresent.items[i] | ctx->srcpresent.items[i];
+
+    if (err)
+        return true;
 
-    // check nextarg
-    else {
-        char *end;
-        val = strtof(nextarg, &end);
+    // diff every field that isn't pinned by argv, lists in scratch are new
+    // allocations and are dropped again when unchanged. Unchanged strings
+    // still take the pointer from scratch, the old one may point into a
+    // stale source buffer.
+    char *block = NULL;
+    for (int i = 0; i < ctx->optlist.count; i++) {
+        opt_t *opt = &ctx->optlist.items[i];
+        if (!opt->field || ((ctx->argvpresent.items[i / 64] >> (i % 64)) & 1))
+            continue;
 
-        if (end - nextarg != strlen(nextarg)) {
-            ustr_builder_printf(&ctx->errorlog, "Invalid character for float flag '%s'\n", arg);
-            ustr_builder_printf(&ctx->errorlog, "%s\n", nextarg);
-            ustr_builder_printf(&ctx->errorlog, "%*s\n", end - nextarg + 1, "^");
-            rc = -1;
-        } else {
-            rc = 2;
+        bool equal = field_equal(opt, cur, scratch);
+        if (equal && (opt->dtype == CARGS_LIST))
+            free(*(char ***)(scratch + opt->offset));
+        if (equal && ((opt->dtype != CARGS_STR) || (*(char **)(cur + opt->offset) == *(char **)(scratch + opt->offset))))
+            continue;
+
+        if (block == NULL) {
+            block = umalloc(ctx->structsize);
+            memcpy(block, cur, ctx->structsize);
+        }
+
+        if (equal) {
+            *(char **)(block + opt->offset) = *(char **)(scratch + opt->offset);
+            continue;
         }
+
+        if (opt->dtype == CARGS_LIST) {
+            retire(ctx, *(char ***)(cur + opt->offset));
+            memcpy(block + opt->lenoffset, scratch + opt->lenoffset, sizeof(int));
+        }
+        memcpy(block + opt->offset, scratch + opt->offset, dtype_size(opt->dtype));
+
+        if (nchanged)
+            (*nchanged)++;
     }
 
-    if (rc > 0)
-        *(float *)opt->ptr = val;
+    if (block) {
+        atomic_store_explicit(&ctx->current, block, memory_order_release);
+        retire(ctx, cur);
+    }
 
-    return rc;
+    // nothing published points into the stale buffers anymore
+    for (int i = 0; i < ctx->stale.count; i++)
+        retire(ctx, ctx->stale.items[i]);
+    ctx->stale.count = 0;
+
+    return false;
 }
 
-int
-parse_opt_str(ctx_t *ctx, opt_t *opt, char *arg, char *nextarg)
+const void *
+cargs_current(cargs_t context)
 {
-    UASSERT(opt);
-    UASSERT(arg);
+    UASSERT(context);
+    return atomic_load_explicit(&((ctx_t *)context)->current, memory_order_acquire);
+}
 
-    size_t arglen = strlen(arg);
-    int rc;
-    char *s;
+void
+cargs_reclaim(cargs_t context)
+{
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    for (int i = 0; i < ctx->retired.count; i++)
+        free(ctx->retired.items[i]);
+    ctx->retired.count = 0;
+}
 
-    if (opt->namelen < arglen) {
+#define XXH_P1 0x9e3779b185ebca87ull
+#define XXH_P2 0xc2b2ae3d27d4eb4full
+#define XXH_P3 0x165667b19e3779f9ull
+#define XXH_P4 0x85ebca77c2b2ae63ull
+#define XXH_P5 0x27d4eb2f165667c5ull
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
 
-        s = (arg[opt->namelen] == '=')
-            ? arg + opt->namelen + 1
-            : arg + opt->namelen;
+uint64_t
+xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_P2;
+    acc = ROTL64(acc, 31);
+    return acc * XXH_P1;
+}
 
-        rc = 1;
+// XXH64
+uint64_t
+xxh64(const char *p, size_t len, uint64_t seed)
+{
+    const char *end = p + len;
+    uint64_t h, k;
+    uint32_t w;
+
+    if (len >= 32) {
+        uint64_t v[4] = { seed + XXH_P1 + XXH_P2, seed + XXH_P2, seed, seed - XXH_P1 };
+        do {
+            for (int i = 0; i < 4; i++, p += 8) {
+                memcpy(&k, p, 8);
+                v[i] = xxh_round(v[i], k);
+            }
+        } while (p + 32 <= end);
+        h = ROTL64(v[0], 1) + ROTL64(v[1], 7) + ROTL64(v[2], 12) + ROTL64(v[3], 18);
+        for (int i = 0; i < 4; i++)
+            h = (h ^ xxh_round(0, v[i])) * XXH_P1 + XXH_P4;
+    } else {
+        h = seed + XXH_P5;
     }
 
-    // missing operand
-    else if (nextarg == NULL) {
-        ustr_builder_printf(&ctx->errorlog, "Missing operand for flag '%s'\n", opt->name);
-        rc = -1;
+    h += len;
+    for (; p + 8 <= end; p += 8) {
+        memcpy(&k, p, 8);
+        h ^= xxh_round(0, k);
+        h = ROTL64(h, 27) * XXH_P1 + XXH_P4;
     }
-
-    // check nextarg
-    else {
-        s = nextarg;
-        rc = 2;
+    if (p + 4 <= end) {
+        memcpy(&w, p, 4);
+        h ^= w * XXH_P1;
+        h = ROTL64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (unsigned char)*p * XXH_P5;
+        h = ROTL64(h, 11) * XXH_P1;
     }
 
-    if (rc > 0)
-        *(char **)opt->ptr = s;
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
 
-    return rc;
+// each token is hashed with its terminator, chained through the seed
+uint64_t
+argv_hash(int argc, char **argv)
+{
+    uint64_t h = argc;
+    for (int i = 0; i < argc; i++)
+        h = xxh64(argv[i], strlen(argv[i]) + 1, h);
+    return h;
 }
 
+// lazy mode defers conversion and streaming lists have side effects, the
+// cache would skip both
 bool
-cargs_parse(cargs_t context, const char *name, int argc, char **argv)
+cache_usable(ctx_t *ctx)
 {
-    UASSERT(context);
-    ctx_t *ctx = (ctx_t *)context;
-
-    // parse optional flags
-    for (int i = 0; i < argc; ) {
-        char *arg = argv[i];
-        char *nextarg = ((i + 1) < argc) ? argv[i+1] : NULL;
+    return ctx->cache.capacity && !ctx->lazy && !ctx->reloading && !ctx->cache.nstreams;
+}
 
-        int optidx = optlist_best_match_name(&ctx->optlist, arg);
-        if (optidx < 0) {
-            ustr_builder_printf(&ctx->errorlog, "Unknown flag '%s'\n", arg);
-            return true;
-        }
+void
+cache_clear(ctx_t *ctx)
+{
+    cache_t *cache = &ctx->cache;
+    for (int i = 0; i < cache->count; i++)
+        free(cache->entries[i].buf);
+    cache->count = 0;
+    cache->hand = 0;
+    if (cache->buckets)
+        memset(cache->buckets, 0xff, cache->nbuckets * sizeof(int));
+}
 
-        opt_t *opt = &ctx->optlist.items[optidx];
+centry_t *
+cache_find(ctx_t *ctx, uint64_t hash, int argc, char **argv)
+{
+    cache_t *cache = &ctx->cache;
+    for (int i = cache->buckets[hash & (cache->nbuckets - 1)]; i >= 0; i = cache->entries[i].next) {
+        centry_t *e = &cache->entries[i];
+        if ((e->hash != hash) || (e->argc != argc))
+            continue;
 
-        if (opt->processed) {
-            ustr_builder_printf(&ctx->errorlog, "Duplicate flag '%s'\n", opt->name);
-            return true;
+        // the hash only narrows it down, the key decides
+        const char *k = e->buf + e->keyoff;
+        const char *kend = k + e->keylen;
+        int j = 0;
+        for (; j < argc; j++) {
+            size_t len = strlen(argv[j]) + 1;
+            if (((size_t)(kend - k) < len) || (0 != memcmp(k, argv[j], len)))
+                break;
+            k += len;
         }
+        if ((j == argc) && (k == kend))
+            return e;
+    }
+    return NULL;
+}
 
-        int n;
-
-        switch (opt->dtype) {
-        case CARGS_BOOL: n = parse_opt_flag(ctx, opt, arg); break;
-        case CARGS_INT: n = parse_opt_int(ctx, opt, arg, nextarg); break;
-        case CARGS_FLOAT: n = parse_opt_float(ctx, opt, arg, nextarg); break;
-        case CARGS_STR: n = parse_opt_str(ctx, opt, arg, nextarg); break;
-        case CARGS_LIST: n = parse_opt_str_list(ctx, opt, arg, nextarg); break;
-        default:
-            UASSERT(0 && "unreachable");
-            break;
-        }
+bool
+cache_hit(ctx_t *ctx, centry_t *e, char **argv)
+{
+    e->ref = true;
 
-        // error
-        if (n < 0)
-            return true;
+    if (e->nviol > ctx->violations.capacity)
+        da_resize(&ctx->violations, e->nviol);
+    memcpy(ctx->violations.items, e->buf + e->violoff, e->nviol * sizeof(cargs_violation_t));
+    ctx->violations.count = e->nviol;
 
-        opt->processed = true;
-        i += n;
+    if (e->err) {
+        da_append_many(&ctx->errorlog, e->buf + e->erroff, e->errlen);
+        return true;
     }
 
-    for (int i = 0; i < ctx->optlist.count; i++) {
-        opt_t *opt = &ctx->optlist.items[i];
+    restore_image(ctx, e->buf, (char **)(e->buf + e->arroff));
+    memcpy(ctx->argvpresent.items, e->buf + e->presoff, ctx->argvpresent.count * sizeof(uint64_t));
 
-        if (opt->processed)
-            continue;
+    // positionals point into this argv, only their indices are kept
+    if (e->nops > ctx->operands.capacity)
+        da_resize(&ctx->operands, e->nops);
+    memcpy(ctx->operands.items, e->buf + e->opsoff, e->nops * sizeof(int));
+    ctx->operands.count = e->nops;
 
-        switch (opt->dtype) {
-        case CARGS_BOOL:
-            *(bool *)opt->ptr = (bool)opt->def;
-            break;
-        case CARGS_INT:
-            *(int *)opt->ptr = (int)opt->def;
-            break;
-        case CARGS_FLOAT:
-            *(float *)opt->ptr = (float)opt->def;
-            break;
-        case CARGS_STR:
-            *(char **)opt->ptr = (char *)opt->def;
-            break;
-        case CARGS_LIST:
-            *(char ***)opt->ptr = (char **)opt->def;
-            *opt->ptrlen = 0;
-        default:
-            break;
+    return parse_operands(ctx, argv);
+}
+
+void
+cache_store(ctx_t *ctx, uint64_t hash, int argc, char **argv, bool err)
+{
+    cache_t *cache = &ctx->cache;
+
+    size_t imgsize = 0;
+    if (!err) {
+        imgsize = snapshot(ctx, NULL, 0);
+        if (imgsize == 0) {
+            ctx->errorlog.count = 0;
+            return;
         }
     }
 
-    return false;
+    size_t keylen = 0;
+    for (int i = 0; i < argc; i++)
+        keylen += strlen(argv[i]) + 1;
+
+    centry_t e;
+    e.hash = hash;
+    e.argc = argc;
+    e.ref = false;
+    e.err = err;
+    e.presoff = (imgsize + 7) & ~(size_t)7;
+    e.violoff = e.presoff + ctx->argvpresent.count * sizeof(uint64_t);
+    e.nviol = ctx->violations.count;
+    e.opsoff = e.violoff + e.nviol * sizeof(cargs_violation_t);
+    e.nops = err ? 0 : ctx->operands.count;
+    e.keyoff = e.opsoff + e.nops * sizeof(int);
+    e.keylen = keylen;
+    e.erroff = e.keyoff + keylen;
+    e.errlen = err ? ctx->errorlog.count : 0;
+
+    // a free slot, else the first entry not referenced since the hand passed
+    int idx;
+    if (cache->count < cache->capacity) {
+        idx = cache->count++;
+        e.buf = NULL;
+    } else {
+        while (cache->entries[cache->hand].ref) {
+            cache->entries[cache->hand].ref = false;
+            cache->hand = (cache->hand + 1) % cache->capacity;
+        }
+        idx = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+
+        centry_t *old = &cache->entries[idx];
+        int *link = &cache->buckets[old->hash & (cache->nbuckets - 1)];
+        while (*link != idx)
+            link = &cache->entries[*link].next;
+        *link = old->next;
+        e.buf = old->buf;
+    }
+
+    e.buf = urealloc(e.buf, e.erroff + e.errlen + 1);
+    if (!err)
+        snapshot(ctx, e.buf, imgsize);
+    memcpy(e.buf + e.presoff, ctx->argvpresent.items, ctx->argvpresent.count * sizeof(uint64_t));
+    memcpy(e.buf + e.violoff, ctx->violations.items, e.nviol * sizeof(cargs_violation_t));
+    memcpy(e.buf + e.opsoff, ctx->operands.items, e.nops * sizeof(int));
+    char *k = e.buf + e.keyoff;
+    for (int i = 0; i < argc; i++) {
+        size_t len = strlen(argv[i]) + 1;
+        memcpy(k, argv[i], len);
+        k += len;
+    }
+    memcpy(e.buf + e.erroff, ctx->errorlog.items, e.errlen);
+
+    // list arrays are built once here so lists from a hit live in the entry
+    e.arroff = (e.erroff + e.errlen + 7) & ~(size_t)7;
+    if (!err) {
+        size_t nstrs = snap_count_strs(ctx, e.buf);
+        e.buf = urealloc(e.buf, e.arroff + nstrs * sizeof(char *));
+        snap_build_arrays(ctx, e.buf, (char **)(e.buf + e.arroff));
+    }
+
+    int *bucket = &cache->buckets[hash & (cache->nbuckets - 1)];
+    e.next = *bucket;
+    *bucket = idx;
+    cache->entries[idx] = e;
+}
+
+void
+cargs_cache(cargs_t context, int entries)
+{
+    UASSERT(context);
+    UASSERT(entries >= 0);
+    ctx_t *ctx = (ctx_t *)context;
+    cache_t *cache = &ctx->cache;
+
+    cache_clear(ctx);
+    free(cache->entries);
+    free(cache->buckets);
+    cache->entries = NULL;
+    cache->buckets = NULL;
+    cache->capacity = entries;
+    cache->hits = 0;
+    cache->misses = 0;
+
+    if (entries == 0)
+        return;
+
+    cache->nbuckets = 16;
+    while (cache->nbuckets < entries)
+        cache->nbuckets *= 2;
+    cache->entries = umalloc(entries * sizeof(centry_t));
+    cache->buckets = umalloc(cache->nbuckets * sizeof(int));
+    memset(cache->buckets, 0xff, cache->nbuckets * sizeof(int));
+}
+
+void
+cargs_cache_stats(cargs_t context, size_t *hits, size_t *misses)
+{
+    UASSERT(context);
+    ctx_t *ctx = (ctx_t *)context;
+    if (hits)
+        *hits = ctx->cache.hits;
+    if (misses)
+        *misses = ctx->cache.misses;
 }
@@ -2,8 +2,13 @@
 #define CARGS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef uintptr_t cargs_t;
 
 void cargs_init(cargs_t *context);
@@ -20,6 +25,149 @@ bool cargs_add_opt_flag(cargs_t context, bool *v, bool def, const char *name, co
 bool cargs_add_opt_int(cargs_t context, int *v, int def, const char *name, const char *help);
 bool cargs_add_opt_float(cargs_t context, float *v, float def, const char *name, const char *help);
 bool cargs_add_opt_str(cargs_t context, char **v, const char *def, const char *name, const char *help);
+// the array of a parsed list is owned by the context and stays valid until
+// the next parse or cargs_delete
 bool cargs_add_opt_str_list(cargs_t context, char ***v, int *vlen, char delim, const char *name, const char *help);
 
+// streaming list: `cb` is called for each element as the list is scanned,
+// `s` points into argv and is not terminated. Returning true from `cb`
+// aborts the parse with an error. The list itself is never stored.
+typedef bool (*cargs_list_cb_t)(void *user, const char *s, int len, int index);
+
+bool cargs_add_opt_list_cb(cargs_t context, cargs_list_cb_t cb, void *user, char delim, const char *name, const char *help);
+
+// positional arguments: tokens not starting with '-', and every token after
+// "--", are operands. Named slots are filled in registration order and are
+// required. The tail receives indices into argv of the remaining operands.
+bool cargs_add_pos(cargs_t context, char **v, const char *name, const char *help);
+bool cargs_add_pos_tail(cargs_t context, int **v, int *vlen, const char *name, const char *help);
+
+// constraints between options, evaluated at the end of cargs_parse. Each
+// takes a NULL-terminated list of flags that must already be added.
+//   cargs_require:   every listed flag must be given
+//   cargs_requires:  if the first flag is given, all others must be too
+//   cargs_conflicts: at most one of the listed flags may be given
+//   cargs_one_of:    at least one of the listed flags must be given
+typedef enum {
+    CARGS_RULE_REQUIRED,
+    CARGS_RULE_REQUIRES,
+    CARGS_RULE_CONFLICTS,
+    CARGS_RULE_ONE_OF,
+} cargs_rule_t;
+
+typedef struct {
+    cargs_rule_t rule;
+    const char *name;
+    const char *other;
+} cargs_violation_t;
+
+bool cargs_require(cargs_t context, const char *name, ...);
+bool cargs_requires(cargs_t context, const char *name, ...);
+bool cargs_conflicts(cargs_t context, const char *name, ...);
+bool cargs_one_of(cargs_t context, const char *name, ...);
+
+// violations found by the last parse, one per failed rule
+const cargs_violation_t *cargs_violations(cargs_t context, int *count);
+
+// lazy mode: parsing only records the argv span of each option, values are
+// converted and memoized on the first cargs_get_* call. Bound pointers are
+// not written and may be NULL. Conversion errors are reported by the getter,
+// or for all options at once by cargs_validate; both return true if error.
+// Must be set before options are added.
+void cargs_set_lazy(cargs_t context, bool lazy);
+
+bool cargs_get_flag(cargs_t context, const char *name, bool *v);
+bool cargs_get_int(cargs_t context, const char *name, int *v);
+bool cargs_get_float(cargs_t context, const char *name, float *v);
+bool cargs_get_str(cargs_t context, const char *name, char **v);
+bool cargs_get_str_list(cargs_t context, const char *name, char ***v, int *vlen);
+bool cargs_validate(cargs_t context);
+
+// repeatable options: every occurrence is appended to a contiguous buffer
+// owned by the context. `*v` and `*vlen` are set once parsing completes and
+// stay valid until the next parse or cargs_delete.
+bool cargs_add_opt_int_accum(cargs_t context, int **v, int *vlen, const char *name, const char *help);
+bool cargs_add_opt_float_accum(cargs_t context, float **v, int *vlen, const char *name, const char *help);
+bool cargs_add_opt_str_accum(cargs_t context, char ***v, int *vlen, const char *name, const char *help);
+
+// count occurrences of repeatable options in a first pass over argv and
+// the loaded config files so their buffers are allocated at most once per
+// parse
+void cargs_set_precount(cargs_t context, bool precount);
+
+// struct binding: options are bound to fields of a user struct of `size`
+// bytes by offset (see CARGS_FIELD). Defaults are collected in a prebuilt
+// image of the struct that is copied in before parsing.
+void cargs_bind_struct(cargs_t context, size_t size);
+
+#define CARGS_FIELD(type, member) offsetof(type, member)
+
+bool cargs_add_field_flag(cargs_t context, size_t offset, bool def, const char *name, const char *help);
+bool cargs_add_field_int(cargs_t context, size_t offset, int def, const char *name, const char *help);
+bool cargs_add_field_float(cargs_t context, size_t offset, float def, const char *name, const char *help);
+bool cargs_add_field_str(cargs_t context, size_t offset, const char *def, const char *name, const char *help);
+bool cargs_add_field_str_list(cargs_t context, size_t offset, size_t lenoffset, char delim, const char *name, const char *help);
+
+// namespaces: flags with dotted names (--db.pool.size) are resolved one
+// '.' separated segment at a time, and their values must follow '=' or be
+// the next token. cargs_help lists them in one section per namespace.
+// cargs_reset_group restores the defaults of every flag under `prefix`;
+// struct-bound flags are reset in the struct at `base`, which may be NULL
+// if the namespace has none.
+// cargs_mount adds the flags of a reusable `group` context under `prefix`;
+// struct-bound group fields are placed at `offset` in this context's struct.
+bool cargs_reset_group(cargs_t context, void *base, const char *prefix);
+bool cargs_mount(cargs_t context, const char *prefix, cargs_t group, size_t offset);
+
+// parse into the struct at `base`, returns true if error
+bool cargs_parse_struct(cargs_t context, void *base, const char *name, int argc, char **argv);
+
+// config files hold flags in command line syntax, separated by whitespace;
+// '#' comments out the rest of a line. Files are applied before argv so
+// argv overrides them, and later files override earlier ones.
+bool cargs_load_file(cargs_t context, const char *path);
+
+// hot reload of struct-bound options from the loaded config files. After
+// cargs_parse_struct, cargs_watch publishes a copy of the parsed struct and
+// returns an inotify fd to poll. When it is readable, cargs_reload re-reads
+// the changed files and publishes a new block in which only the changed
+// fields differ; options given on argv keep their values. Readers get the
+// current block with cargs_current, which never locks. Superseded blocks
+// stay valid until cargs_reclaim, to be called once no reader can still
+// hold one. Reloads never touch the struct given to cargs_parse_struct, it
+// keeps the values of that parse and stays valid until the next parse or
+// cargs_delete.
+bool cargs_watch(cargs_t context, int *fd);
+bool cargs_reload(cargs_t context, int *nchanged);
+const void *cargs_current(cargs_t context);
+void cargs_reclaim(cargs_t context);
+
+// snapshot of the last parse: option values, presence and lists are
+// serialized into a relocatable image (native byte order). Writes at most
+// `size` bytes to `buf` and returns the full image size, like snprintf.
+// Returns 0 if error. Positional arguments are not included.
+size_t cargs_snapshot(cargs_t context, void *buf, size_t size);
+
+// rebind the values of an image to the registered options without parsing.
+// The image must come from a context with identical options and must stay
+// alive while the values are used, strings point into it. The pointer arrays
+// of lists are rebuilt in a buffer owned by the context and stay valid only
+// until the next cargs_restore or cargs_restore_struct. Returns true if
+// error. Contexts with struct-bound options need cargs_restore_struct.
+bool cargs_restore(cargs_t context, const void *buf, size_t size);
+bool cargs_restore_struct(cargs_t context, void *base, const void *buf, size_t size);
+
+// parse cache: the results of up to `entries` distinct argv vectors are
+// memoized, errors included, and a repeated argv is restored from its entry
+// without lookup or conversion. Entries are keyed by the argv contents and
+// evicted in CLOCK order. Strings and lists restored from a hit point into
+// the entry and stay valid until it is evicted. 0 disables the cache. Not
+// used in lazy mode or when streaming lists are registered.
+void cargs_cache(cargs_t context, int entries);
+void cargs_cache_stats(cargs_t context, size_t *hits, size_t *misses);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // CARGS_H
@@ -0,0 +1,445 @@
+#ifndef CARGS_HPP
+#define CARGS_HPP
+
+// C++17 front end. Options are declared as a constexpr table of typed
+// descriptors bound to members of a result struct. The name lookup, the
+// help text and the per-type dispatch are all generated at compile time,
+// so nothing is registered at startup.
+//
+//   struct cfg { bool verbose; int jobs; const char *out; };
+//
+//   static constexpr auto options = cargs::make_table(
+//       cargs::flag(&cfg::verbose, false, "-v", "verbose output"),
+//       cargs::integer(&cfg::jobs, 1, "-j", "number of jobs"),
+//       cargs::str(&cfg::out, "a.out", "-o", "output file"));
+//
+//   using parser = cargs::parser<options>;
+//
+//   cfg c;
+//   std::string err;
+//   if (parser::parse(c, argc - 1, argv + 1, &err)) ...
+//
+// parser<options>::register_into adds the same options to a C context as
+// struct fields, for the features only the C API has. For the same argv,
+// parse sets the same values and errors as cargs_parse_struct on that
+// context. The exception is dotted names, which are matched as plain
+// names here, not segment by segment.
+
+#include <array>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "cargs.h"
+
+namespace cargs {
+
+template <typename S, typename T>
+struct opt {
+    T S::*member;
+    T def;
+    std::string_view name;
+    std::string_view help;
+};
+
+template <typename S>
+constexpr opt<S, bool>
+flag(bool S::*member, bool def, std::string_view name, std::string_view help)
+{
+    return { member, def, name, help };
+}
+
+template <typename S>
+constexpr opt<S, int>
+integer(int S::*member, int def, std::string_view name, std::string_view help)
+{
+    return { member, def, name, help };
+}
+
+template <typename S>
+constexpr opt<S, float>
+real(float S::*member, float def, std::string_view name, std::string_view help)
+{
+    return { member, def, name, help };
+}
+
+template <typename S>
+constexpr opt<S, const char *>
+str(const char *S::*member, const char *def, std::string_view name, std::string_view help)
+{
+    return { member, def, name, help };
+}
+
+template <typename S, typename... T>
+struct table {
+    using result_type = S;
+    static constexpr std::size_t count = sizeof...(T);
+
+    std::tuple<opt<S, T>...> opts;
+
+    constexpr table(opt<S, T>... o) : opts(o...) {}
+
+    constexpr std::array<std::string_view, count>
+    names() const
+    {
+        return std::apply([](const auto &... o) {
+            return std::array<std::string_view, count>{ o.name... };
+        }, opts);
+    }
+
+    constexpr std::array<std::string_view, count>
+    helps() const
+    {
+        return std::apply([](const auto &... o) {
+            return std::array<std::string_view, count>{ o.help... };
+        }, opts);
+    }
+};
+
+template <typename S, typename... T>
+constexpr table<S, T...>
+make_table(opt<S, T>... o)
+{
+    return table<S, T...>(o...);
+}
+
+namespace detail {
+
+struct entry {
+    std::string_view name;
+    std::size_t idx;
+};
+
+// options sorted by name, plus the distinct name lengths (longest first)
+// so a token resolves to its longest matching name like cargs_parse does
+template <std::size_t N>
+struct lookup {
+    std::array<entry, N> sorted;
+    std::array<std::size_t, N> lengths;
+    std::size_t nlengths;
+};
+
+template <std::size_t N>
+constexpr lookup<N>
+make_lookup(const std::array<std::string_view, N> &names)
+{
+    lookup<N> l{};
+    for (std::size_t i = 0; i < N; i++) {
+        entry e{ names[i], i };
+        std::size_t j = i;
+        for (; (j > 0) && (e.name < l.sorted[j-1].name); j--)
+            l.sorted[j] = l.sorted[j-1];
+        l.sorted[j] = e;
+    }
+
+    l.nlengths = 0;
+    for (std::size_t i = 0; i < N; i++) {
+        std::size_t len = names[i].size();
+        std::size_t j = 0;
+        while ((j < l.nlengths) && (l.lengths[j] > len))
+            j++;
+        if ((j < l.nlengths) && (l.lengths[j] == len))
+            continue;
+        for (std::size_t k = l.nlengths; k > j; k--)
+            l.lengths[k] = l.lengths[k-1];
+        l.lengths[j] = len;
+        l.nlengths++;
+    }
+
+    return l;
+}
+
+template <std::size_t N>
+constexpr std::size_t
+name_width(const std::array<std::string_view, N> &names)
+{
+    std::size_t w = 0;
+    for (const auto &n : names)
+        w = (n.size() > w) ? n.size() : w;
+    return w;
+}
+
+// same layout as the option lines of cargs_help
+template <std::size_t N>
+constexpr std::size_t
+help_size(const std::array<std::string_view, N> &names, const std::array<std::string_view, N> &helps)
+{
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < N; i++)
+        size += 3 + name_width(names) + 3 + helps[i].size() + 1;
+    return size;
+}
+
+template <std::size_t Size, std::size_t N>
+constexpr std::array<char, Size>
+make_help(const std::array<std::string_view, N> &names, const std::array<std::string_view, N> &helps)
+{
+    std::array<char, Size> out{};
+    std::size_t pos = 0;
+    std::size_t w = name_width(names);
+    for (std::size_t i = 0; i < N; i++) {
+        for (int k = 0; k < 3; k++)
+            out[pos++] = ' ';
+        for (char c : names[i])
+            out[pos++] = c;
+        for (std::size_t k = names[i].size(); k < w + 3; k++)
+            out[pos++] = ' ';
+        for (char c : helps[i])
+            out[pos++] = c;
+        out[pos++] = '\n';
+    }
+    return out;
+}
+
+// appends to `err` like ustr_builder_printf appends to the C error log
+inline void
+set_error(std::string *err, const char *fmt, ...)
+{
+    if (err == nullptr)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    int len = std::vsnprintf(nullptr, 0, fmt, args);
+    va_end(args);
+    std::size_t at = err->size();
+    err->resize(at + len + 1);
+    va_start(args, fmt);
+    std::vsnprintf(&(*err)[at], len + 1, fmt, args);
+    va_end(args);
+    err->resize(at + len);
+}
+
+} // namespace detail
+
+template <const auto &Table>
+struct parser {
+    using table_type = std::remove_cv_t<std::remove_reference_t<decltype(Table)>>;
+    using result_type = typename table_type::result_type;
+    static constexpr std::size_t count = table_type::count;
+
+    static constexpr auto lookup = detail::make_lookup(Table.names());
+    static constexpr auto help_block = detail::make_help<detail::help_size(Table.names(), Table.helps())>(Table.names(), Table.helps());
+
+    // default image of the result, applied with one copy before parsing
+    static constexpr result_type defaults = std::apply([](const auto &... o) {
+        result_type r{};
+        ((r.*(o.member) = o.def), ...);
+        return r;
+    }, Table.opts);
+
+    // index of the option with the longest name that prefixes `arg`, or -1
+    static int
+    find(std::string_view arg)
+    {
+        for (std::size_t l = 0; l < lookup.nlengths; l++) {
+            std::size_t len = lookup.lengths[l];
+            if (arg.size() < len)
+                continue;
+            std::string_view key = arg.substr(0, len);
+            std::size_t lo = 0, hi = count;
+            while (lo < hi) {
+                std::size_t mid = (lo + hi) / 2;
+                if (lookup.sorted[mid].name < key)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if ((lo < count) && (lookup.sorted[lo].name == key))
+                return (int)lookup.sorted[lo].idx;
+        }
+        return -1;
+    }
+
+    // parses option I, returns the number of tokens consumed or -1
+    template <std::size_t I>
+    static int
+    parse_one(result_type &r, char *arg, char *nextarg, std::string *err)
+    {
+        constexpr auto o = std::get<I>(Table.opts);
+        using T = std::remove_cv_t<decltype(o.def)>;
+        std::size_t namelen = o.name.size();
+        std::size_t arglen = std::strlen(arg);
+
+        // error messages are the ones of the parse_opt_* functions in cargs.c
+        if constexpr (std::is_same_v<T, bool>) {
+            if (arglen != namelen) {
+                detail::set_error(err, "Flag doesn't match (%.*s) (%s)\n", (int)namelen, o.name.data(), arg);
+                return -1;
+            }
+            r.*(o.member) = true;
+            return 1;
+        } else {
+            int rc;
+            char *val;
+            if (arglen > namelen) {
+                val = arg + namelen + (arg[namelen] == '=');
+                rc = 1;
+            } else if (nextarg == nullptr) {
+                if constexpr (std::is_same_v<T, const char *>)
+                    detail::set_error(err, "Missing operand for flag '%.*s'\n", (int)namelen, o.name.data());
+                else
+                    detail::set_error(err, "Missing operand for flag '%s'\n", arg);
+                return -1;
+            } else {
+                val = nextarg;
+                rc = 2;
+            }
+
+            if constexpr (std::is_same_v<T, const char *>) {
+                r.*(o.member) = val;
+            } else {
+                constexpr const char *kind = std::is_same_v<T, int> ? "integer" : "float";
+                char *end;
+                T v;
+                if constexpr (std::is_same_v<T, int>)
+                    v = (int)std::strtol(val, &end, 10);
+                else
+                    v = std::strtof(val, &end);
+                if (*end != '\0') {
+                    // the caret points at the bad character of the token
+                    char *tok = (rc == 1) ? arg : nextarg;
+                    if (rc == 1)
+                        detail::set_error(err, "Invalid character for %s flag\n", kind);
+                    else
+                        detail::set_error(err, "Invalid character for %s flag '%s'\n", kind, arg);
+                    detail::set_error(err, "%s\n%*s\n", tok, (int)(end - tok + 1), "^");
+                    return -1;
+                }
+                r.*(o.member) = v;
+            }
+            return rc;
+        }
+    }
+
+    // compile-time generated dispatch on the option index
+    template <std::size_t... I>
+    static int
+    dispatch(std::size_t idx, result_type &r, char *arg, char *nextarg, std::string *err, std::index_sequence<I...>)
+    {
+        int n = -1;
+        (void)((idx == I ? (n = parse_one<I>(r, arg, nextarg, err), true) : false) || ...);
+        return n;
+    }
+
+    // returns true if error. Tokens are split like cargs_parse splits them:
+    // tokens not starting with '-', a lone "-" and everything after "--"
+    // are operands. The table has no positionals, so the first operand is
+    // reported once all flags are parsed, as cargs_parse does. `err` gets
+    // the text cargs_error would return.
+    static bool
+    parse(result_type &r, int argc, char **argv, std::string *err = nullptr)
+    {
+        r = defaults;
+        if (err)
+            err->clear();
+
+        bool rc = false;
+        std::array<bool, count> seen{};
+        bool endopts = false;
+        char *operand = nullptr;
+        for (int i = 0; i < argc; ) {
+            char *arg = argv[i];
+            char *nextarg = ((i + 1) < argc) ? argv[i+1] : nullptr;
+
+            if (endopts || (arg[0] != '-') || (arg[1] == '\0')) {
+                if (operand == nullptr)
+                    operand = arg;
+                i++;
+                continue;
+            }
+
+            if ((arg[1] == '-') && (arg[2] == '\0')) {
+                endopts = true;
+                i++;
+                continue;
+            }
+
+            int idx = find(arg);
+            if (idx < 0) {
+                detail::set_error(err, "Unknown flag '%s'\n", arg);
+                rc = true;
+                break;
+            }
+            if (seen[idx]) {
+                detail::set_error(err, "Duplicate flag '%.*s'\n", (int)Table.names()[idx].size(), Table.names()[idx].data());
+                rc = true;
+                break;
+            }
+
+            int n = dispatch(idx, r, arg, nextarg, err, std::make_index_sequence<count>{});
+            if (n < 0) {
+                rc = true;
+                break;
+            }
+
+            seen[idx] = true;
+            i += n;
+        }
+
+        if (!rc && operand) {
+            detail::set_error(err, "Unexpected argument '%s'\n", operand);
+            rc = true;
+        }
+
+        // cargs_error drops the trailing newline
+        if (rc && err && !err->empty() && (err->back() == '\n'))
+            err->pop_back();
+
+        return rc;
+    }
+
+    static std::string
+    help(std::string_view name)
+    {
+        std::string s = "Usage: ";
+        s.append(name);
+        s.append(" [OPTIONS] command\n\nOptions:\n");
+        // cargs_help drops the trailing newline
+        if (help_block.size() > 0)
+            s.append(help_block.data(), help_block.size() - 1);
+        return s;
+    }
+
+    // register the table with a C context as fields of result_type, so
+    // cargs_parse_struct and the rest of the C API work on the same struct
+    static bool
+    register_into(cargs_t context)
+    {
+        static_assert(std::is_standard_layout_v<result_type>, "result struct must be standard layout");
+        cargs_bind_struct(context, sizeof(result_type));
+        return std::apply([context](const auto &... o) {
+            return (add_field(context, o) || ...);
+        }, Table.opts);
+    }
+
+private:
+    template <typename T>
+    static bool
+    add_field(cargs_t context, const opt<result_type, T> &o)
+    {
+        const char *base = reinterpret_cast<const char *>(&defaults);
+        std::size_t offset = reinterpret_cast<const char *>(&(defaults.*(o.member))) - base;
+        std::string name(o.name);
+        std::string help(o.help);
+
+        if constexpr (std::is_same_v<T, bool>)
+            return cargs_add_field_flag(context, offset, o.def, name.c_str(), help.c_str());
+        else if constexpr (std::is_same_v<T, int>)
+            return cargs_add_field_int(context, offset, o.def, name.c_str(), help.c_str());
+        else if constexpr (std::is_same_v<T, float>)
+            return cargs_add_field_float(context, offset, o.def, name.c_str(), help.c_str());
+        else
+            return cargs_add_field_str(context, offset, o.def, name.c_str(), help.c_str());
+    }
+};
+
+} // namespace cargs
+
+#endif // CARGS_HPP
@@ -26,8 +26,8 @@ main(int argc, char *argv[])
     cargs_add_opt_int(cargs, &i, 69, "-i", "integer option");
     cargs_add_opt_float(cargs, &f, 123.321, "-f", "float option");
     cargs_add_opt_str(cargs, &s, "default string", "-s", "string option");
-    cargs_add_opt_list(cargs, &list, &listlen, '.', "-l", "string list, delimited by '.'");
-    cargs_add_opt_list(cargs, &csv, &csvlen, ',', "--csv", "comma-separated values");
+    cargs_add_opt_str_list(cargs, &list, &listlen, '.', "-l", "string list, delimited by '.'");
+    cargs_add_opt_str_list(cargs, &csv, &csvlen, ',', "--csv", "comma-separated values");
 
     const char *helpmsg = cargs_help(cargs, argv[0]);
 
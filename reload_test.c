@@ -0,0 +1,105 @@
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cargs.h"
+
+#define UTIL_IMPL
+#include "util.h"
+
+typedef struct {
+    char *name;
+    int port;
+} cfg_t;
+
+static const char *path = "carg-reload-test.conf";
+
+static void
+write_conf(const char *text)
+{
+    FILE *f = fopen(path, "w");
+    UASSERT(f);
+    fputs(text, f);
+    fclose(f);
+}
+
+static bool
+reload(cargs_t cargs, int fd, int *nchanged)
+{
+    struct pollfd p = { fd, POLLIN, 0 };
+    poll(&p, 1, 1000);
+    return cargs_reload(cargs, nchanged);
+}
+
+static bool
+check(cargs_t cargs, const char *name, int port)
+{
+    const cfg_t *cur = cargs_current(cargs);
+    if ((0 == strcmp(cur->name, name)) && (cur->port == port))
+        return false;
+    fprintf(stderr, "expected name=%s port=%d, got name=%s port=%d\n", name, port, cur->name, cur->port);
+    return true;
+}
+
+int
+main(void)
+{
+    cargs_t cargs;
+    cfg_t cfg;
+    int *incl;
+    int nincl;
+    int fd;
+    int nchanged;
+    bool fail = false;
+
+    cargs_init(&cargs);
+    cargs_bind_struct(cargs, sizeof(cfg_t));
+    cargs_add_field_str(cargs, CARGS_FIELD(cfg_t, name), "none", "--name", "name");
+    cargs_add_field_int(cargs, CARGS_FIELD(cfg_t, port), 0, "--port", "port");
+    cargs_add_opt_int_accum(cargs, &incl, &nincl, "-I", "include");
+
+    write_conf("--name foo\n--port 1\n-I 1 -I 2\n");
+    if (cargs_load_file(cargs, path) || cargs_parse_struct(cargs, &cfg, "test", 0, NULL) || cargs_watch(cargs, &fd)) {
+        fprintf(stderr, "%s\n", cargs_error(cargs));
+        return 1;
+    }
+
+    // unchanged strings must not point into the replaced file buffer
+    write_conf("--name foo\n--port 2\n-I 1 -I 2\n");
+    if (reload(cargs, fd, &nchanged)) {
+        fprintf(stderr, "%s\n", cargs_error(cargs));
+        return 1;
+    }
+    cargs_reclaim(cargs);
+    fail |= (nchanged != 1);
+    fail |= check(cargs, "foo", 2);
+
+    // a bad file keeps the published block and its strings alive
+    write_conf("--name bar\n--port x\n");
+    fail |= !reload(cargs, fd, NULL);
+    cargs_reclaim(cargs);
+    fail |= check(cargs, "foo", 2);
+
+    write_conf("--name foo\n--port 3\n-I 1 -I 2\n");
+    fail |= reload(cargs, fd, &nchanged);
+    cargs_reclaim(cargs);
+    fail |= (nchanged != 1);
+    fail |= check(cargs, "foo", 3);
+
+    // reloads skip repeatable options and must leave their buffers alone
+    size_t size = cargs_snapshot(cargs, NULL, 0);
+    char *img = malloc(size);
+    cargs_snapshot(cargs, img, size);
+    fail |= cargs_restore_struct(cargs, &cfg, img, size);
+    fail |= (nincl != 2) || (incl[0] != 1) || (incl[1] != 2);
+    free(img);
+
+    cargs_delete(&cargs);
+    unlink(path);
+
+    printf("%s\n", fail ? "FAIL" : "OK");
+    return fail;
+}
@@ -0,0 +1,124 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cargs.h"
+
+#define UTIL_IMPL
+#include "util.h"
+
+typedef struct {
+    bool verbose;
+    int jobs;
+    float scale;
+    char *out;
+    char **tags;
+    int ntags;
+    int *levels;
+    int nlevels;
+    float *weights;
+    int nweights;
+    char **defs;
+    int ndefs;
+} vals_t;
+
+static char *args_a[] = {
+    "-v", "-j8", "--scale=0.5", "-o", "out.bin", "--tags", "x,y,z",
+    "-l1", "-l2", "-l3", "-w0.25", "-Dfoo", "-Dbar",
+};
+static char *args_b[] = { "-l7", "--tags", "q" };
+
+static void
+init(cargs_t *cargs, vals_t *v)
+{
+    cargs_init(cargs);
+    cargs_add_opt_flag(*cargs, &v->verbose, false, "-v", "verbose");
+    cargs_add_opt_int(*cargs, &v->jobs, 1, "-j", "jobs");
+    cargs_add_opt_float(*cargs, &v->scale, 1.0f, "--scale", "scale");
+    cargs_add_opt_str(*cargs, &v->out, "a.out", "-o", "output");
+    cargs_add_opt_str_list(*cargs, &v->tags, &v->ntags, ',', "--tags", "tags");
+    cargs_add_opt_int_accum(*cargs, &v->levels, &v->nlevels, "-l", "levels");
+    cargs_add_opt_float_accum(*cargs, &v->weights, &v->nweights, "-w", "weights");
+    cargs_add_opt_str_accum(*cargs, &v->defs, &v->ndefs, "-D", "defines");
+}
+
+// values set by parsing args_a
+static bool
+check_a(const char *what, const vals_t *v)
+{
+    bool ok = v->verbose && (v->jobs == 8) && (v->scale == 0.5f) && (0 == strcmp(v->out, "out.bin")) &&
+        (v->ntags == 3) && (0 == strcmp(v->tags[0], "x")) && (0 == strcmp(v->tags[2], "z")) &&
+        (v->nlevels == 3) && (v->levels[0] == 1) && (v->levels[2] == 3) &&
+        (v->nweights == 1) && (v->weights[0] == 0.25f) &&
+        (v->ndefs == 2) && (0 == strcmp(v->defs[0], "foo")) && (0 == strcmp(v->defs[1], "bar"));
+    if (!ok)
+        fprintf(stderr, "%s: values differ from the parse\n", what);
+    return !ok;
+}
+
+static char *
+snapshot(cargs_t cargs, size_t *size)
+{
+    *size = cargs_snapshot(cargs, NULL, 0);
+    char *img = malloc(*size);
+    cargs_snapshot(cargs, img, *size);
+    return img;
+}
+
+int
+main(void)
+{
+    cargs_t cargs;
+    vals_t v;
+    bool fail = false;
+    int na = sizeof(args_a) / sizeof(args_a[0]);
+    int nb = sizeof(args_b) / sizeof(args_b[0]);
+
+    init(&cargs, &v);
+    if (cargs_parse(cargs, "test", na, args_a)) {
+        fprintf(stderr, "%s\n", cargs_error(cargs));
+        return 1;
+    }
+    fail |= check_a("parse", &v);
+
+    size_t size;
+    char *img = snapshot(cargs, &size);
+
+    // restore into a fresh context, then snapshot again as a worker passing
+    // the image on would
+    cargs_t other;
+    vals_t w;
+    init(&other, &w);
+    fail |= cargs_restore(other, img, size);
+    fail |= check_a("restore", &w);
+
+    size_t size2;
+    char *img2 = snapshot(other, &size2);
+    fail |= (size2 != size) || (0 != memcmp(img, img2, size));
+    free(img2);
+    cargs_delete(&other);
+
+    // a cache hit must leave the context as the miss did
+    cargs_cache(cargs, 4);
+    fail |= cargs_parse(cargs, "test", na, args_a);
+    fail |= cargs_parse(cargs, "test", nb, args_b);
+    fail |= (v.nlevels != 1) || (v.levels[0] != 7) || (v.weights != NULL) || (v.ntags != 1);
+    fail |= cargs_parse(cargs, "test", na, args_a);
+    fail |= check_a("hit", &v);
+
+    size_t hits;
+    size_t misses;
+    cargs_cache_stats(cargs, &hits, &misses);
+    fail |= (hits != 1) || (misses != 2);
+
+    img2 = snapshot(cargs, &size2);
+    fail |= (size2 != size) || (0 != memcmp(img, img2, size));
+    free(img2);
+
+    free(img);
+    cargs_delete(&cargs);
+
+    printf("%s\n", fail ? "FAIL" : "OK");
+    return fail;
+}
@@ -99,6 +99,9 @@ ustr_builder_printf(ustr_builder_t *builder, const char *fmt, ...)
     size_t len = vsnprintf(NULL, 0, fmt, args);
     va_end(args);
 
+    da_reserve(builder, len + 1);
+    s = builder->items + builder->count;
+
     va_start(args, fmt);
     vsnprintf(builder->items + builder->count, len + 1, fmt, args);
     va_end(args);